@@ -9,34 +9,41 @@
 #include <linux/i2c.h>
 #include <linux/init.h>
 #include <linux/slab.h>
+#include <linux/bitmap.h>
+#include <linux/ktime.h>
+#include <linux/mutex.h>
+#include <linux/pm_runtime.h>
+#include <linux/sched.h>
+#include <linux/atomic.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/workqueue.h>
+#include <linux/hrtimer.h>
+#include <linux/sched/loadavg.h>
+#include <linux/vmalloc.h>
+#include <linux/fs.h>
+#include <linux/list.h>
+#include <linux/miscdevice.h>
+#include <linux/uaccess.h>
+#include <linux/poll.h>
+#include <linux/wait.h>
+#include <linux/console.h>
+#include <linux/spinlock.h>
+
+#define CREATE_TRACE_POINTS
+#include "eindopdracht_trace.h"
+
+#include "ssd1306.h"
+#include "lcd_capture.h"
+#include "lcd_ioctl.h"
 
 MODULE_LICENSE("Dual BSD/GPL");
 
 /***********************************************************/
 /************************ DEFINES **************************/
 /***********************************************************/
-#define COMMAND ((char)0x00)
-#define DATA ((char)0x40)
-
-#define PUMP_COMMAND ((char)0x8D) //implemented
-#define ENABLE_SCREEN_COMMAND ((char)0xAE)
-#define SET_CLOCK_DIV_COMMAND ((char)0xD5)      //implemented
-#define SET_MUX_COMMAND ((char)0xA8)            //implemented
-#define SET_DISPLAY_OFFSET_COMMAND ((char)0xD3) //implemented
-#define SET_START_LINE ((char)0x40)             //implemented
-#define SET_MEMORY_MODE_COMMAND ((char)0x20)    //implemented
-#define SEG_REMAP_COMMAND ((char)0xA1)          //implemented
-#define SET_COMM_SCAN_COMMAND ((char)0xC8)      //implemented
-#define SET_COMM_PINS_COMMAND ((char)0xDA)      //implemented
-#define SET_CONTRAST_COMMAND ((char)0x81)       //implemented
-#define SET_VCOMM_DETECT_COMMAND ((char)0xDB)   //implemented
-#define SET_DISPLAY_RESUME_COMMAND ((char)0xA4) //implemented
-#define SET_NORMAL_DISPLAY ((char)0xA6)         //implemented
-#define SET_PRECHARGE_COMMAND ((char)0xD9)      //implemented
-#define SET_PAGE_ADDRESS_COMMAND ((char)0x22)
-#define SET_COLUMN_START_ADDRESS ((char)0x21)
-
 #define PUMP_SETTING ((char)0x14)           //implemented
+#define PUMP_OFF_SETTING ((char)0x10)
 #define CLOCK_DIVIDER_SETTING ((char)0x80)  //implemented
 #define MUX_SETTING ((char)31)              //implemented
 #define DISPLAY_OFFSET_SETTING ((char)0x00) //implemented
@@ -52,8 +59,57 @@ MODULE_LICENSE("Dual BSD/GPL");
 
 #define CHARACTER_BYTES ((size_t)5)
 #define CHARACTER_SPACE ((size_t)6)
+#define CHARACTER_HEIGHT ((size_t)8)
+
+#define MAX_REGIONS ((size_t)8)
+#define REGION_NAME_BYTES 16
+#define MAX_FONT_SCALE ((unsigned int)4)
 
 #define SCREEN_WIDTH ((size_t)128)
+#define SCREEN_PAGES ((size_t)8)
+#define SCREEN_BUFFER_SIZE (SCREEN_WIDTH * SCREEN_PAGES)
+#define SCREEN_ROWS (SCREEN_PAGES * (size_t)8)
+#define VISIBLE_PAGES ((size_t)((MUX_SETTING + 1) / 8))
+
+#define MAX_FLUSH_WINDOWS ((size_t)16)
+#define WINDOW_ADDRESS_BYTES ((size_t)7) // COMMAND + page range + column range
+#define RANGE_COMMAND_BYTES ((size_t)3)  // page or column range without COMMAND
+#define PAGE_ADDRESS_BYTES ((size_t)4)   // COMMAND + page start + column nibbles
+#define MEMORY_MODE_BYTES ((size_t)3)    // COMMAND + memory mode
+#define DEFAULT_TRANSACTION_OVERHEAD ((size_t)3)
+#define MAX_TRANSACTION_OVERHEAD ((size_t)64)
+#define CALIBRATION_TRANSACTIONS ((size_t)16)
+#define CALIBRATION_BURST_BYTES ((size_t)128)
+
+#define DEFAULT_ADAPTER_NUMBER 2
+#define DEFAULT_I2C_ADDRESS ((u32)0x3C)
+#define DEFAULT_BUS_FREQUENCY ((u32)100000)
+#define MIN_TRANSFER_SIZE ((size_t)16)
+#define SELF_TEST_BYTES ((SCREEN_PAGES - VISIBLE_PAGES) * SCREEN_WIDTH)
+#define I2C_BITS_PER_BYTE ((u32)9) // eight data bits plus ACK
+
+#define DEFAULT_AUTOSUSPEND_DELAY ((u32)5000) // milliseconds
+#define MAX_INIT_SEQUENCE_BYTES ((size_t)32)
+
+#define FLUSH_RETRIES 2
+#define HISTOGRAM_BUCKETS ((size_t)24) // log2 microseconds, the last bucket collects everything above
+
+#define UPDATE_PRIORITIES ((size_t)2)       // LCD_PRIORITY_NORMAL and LCD_PRIORITY_HIGH
+#define PREEMPT_CHUNK_BYTES ((size_t)256)   // about 23 ms at 100 kHz
+#define MAX_PREEMPTIONS ((size_t)2)         // per flush_screen(), the pass after that is not preemptible
+
+#define MAX_QUEUED_FRAMES ((size_t)8)     // per open file of the character device
+#define PRESENT_MARGIN_NS ((u64)500000)   // waking the present work on top of the transfer itself
+#define PRESENT_LATE_NS ((s64)1000000)    // how late a timed frame may still land
+
+#define RECORDING_BYTES ((size_t)(256 * 1024))
+#define CAPTURE_BYTES ((size_t)(256 * 1024))
+
+#define CONSOLE_COLUMNS (SCREEN_WIDTH / CHARACTER_SPACE)
+#define CONSOLE_BUFFER_BYTES ((size_t)2048)
+#define CONSOLE_INTERVAL_MS 250 // between repaints, a log storm gets at most four a second
+
+#define LOAD_AVERAGES ((size_t)3) // 1, 5 and 15 minutes, sampled every LOAD_FREQ like loadavg
 
 /***********************************************************/
 /************************* TYPES ***************************/
@@ -61,38 +117,474 @@ MODULE_LICENSE("Dual BSD/GPL");
 
 typedef unsigned int uin32_t;
 
+struct lcd_statistics
+{
+    atomic64_t writes;
+    atomic64_t frames_committed;
+    atomic64_t frames_coalesced;
+    atomic64_t frames_identical;
+    atomic64_t bytes;
+    atomic64_t transactions;
+    atomic64_t i2c_errors;
+    atomic64_t i2c_retries;
+    atomic64_t overlays_expired;
+    atomic64_t frames_presented;
+    atomic64_t frames_late;
+    atomic64_t flushes_preempted;
+    atomic64_t console_repaints;
+    atomic64_t console_dropped; // bytes overwritten before a repaint got to them
+    atomic64_t render_time[HISTOGRAM_BUCKETS];
+    atomic64_t queue_time[HISTOGRAM_BUCKETS];
+    atomic64_t flush_time[HISTOGRAM_BUCKETS];
+    atomic64_t restore_time[HISTOGRAM_BUCKETS]; // expiry to restored on the panel
+    atomic64_t present_lateness[HISTOGRAM_BUCKETS]; // target to presented, early frames count as 0
+    atomic64_t pixel_time[UPDATE_PRIORITIES][HISTOGRAM_BUCKETS]; // commit to on the panel
+};
+
+struct lcd_transport
+{
+    const char *name;
+    int (*send)(const char *, size_t);
+};
+
+enum pixel_operation
+{
+    PIXEL_CLEAR,
+    PIXEL_SET,
+    PIXEL_INVERT
+};
+
+enum controller_setting
+{
+    CACHED_DISPLAY,
+    CACHED_CHARGE_PUMP,
+    CACHED_CONTRAST,
+    CACHED_START_LINE,
+    CACHED_MEMORY_MODE,
+    CACHED_PAGE_WINDOW,
+    CACHED_COLUMN_WINDOW,
+    CACHED_SETTINGS
+};
+
+struct flush_window
+{
+    size_t first_page;
+    size_t last_page;
+    size_t first_column;
+    size_t last_column;
+};
+
+// A pane of whole pages with its own cursor (pixels from its top left corner) and font scale
+struct lcd_region
+{
+    bool used;
+    char name[REGION_NAME_BYTES];
+    size_t first_page;
+    size_t last_page;
+    size_t first_column;
+    size_t last_column;
+    unsigned int scale;
+    size_t x;
+    size_t y;
+};
+
+// What one open file of the character device draws, stacked on top of the base layer by z
+struct lcd_layer
+{
+    struct list_head node;
+    s32 z;
+    bool visible;
+    atomic64_t sequence; // last frame committed through this layer
+    ktime_t expires; // 0 while the layer stays until it is hidden
+    struct hrtimer expiry;
+    struct work_struct restore_work;
+    u32 priority; // LCD_PRIORITY_*
+    size_t queued; // timed frames waiting in scheduled_frames
+    struct lcd_presentation presentation;
+    char pixels[SCREEN_BUFFER_SIZE];
+    char mask[SCREEN_BUFFER_SIZE];
+};
+
+// A frame queued for a layer with LCD_QUEUE_FRAME, presented by present_frames()
+struct scheduled_frame
+{
+    struct list_head node;
+    struct lcd_layer *layer;
+    ktime_t target;
+    ktime_t start; // target minus the estimated transfer
+    char pixels[SCREEN_BUFFER_SIZE];
+};
+
+struct flush_plan
+{
+    char memory_mode;
+    size_t window_count;
+    size_t cost;
+    struct flush_window windows[MAX_FLUSH_WINDOWS];
+};
+
 /***********************************************************/
 /****************** FUNCTION PROTOTYPES ********************/
 /***********************************************************/
 
+static int send_init_sequence(unsigned int);
 static void initialize_screen(void);
+static void batch_command(char *, size_t *, const char *, size_t);
 static void reset_screen(void);
 static void reset_cursor(void);
 static void write_buffer_to_screen(void);
 
+static size_t encode_init_sequence(char *, unsigned int);
+static void encode_page_position(char *, size_t, size_t);
+static size_t encode_window_address(char *, const struct flush_window *);
+static size_t encode_window_data(char *, const struct flush_window *, char);
+
+static int i2c_transport_send(const char *, size_t);
+static int recording_transport_send(const char *, size_t);
+static int start_recording(void);
+static void stop_recording(void);
+static ssize_t record_read(struct file *, char __user *, size_t, loff_t *);
+static ssize_t record_write(struct file *, const char __user *, size_t, loff_t *);
+static ssize_t recording_read(struct file *, char __user *, size_t, loff_t *);
+
+static void capture_request(enum capture_interface, loff_t, const char *, size_t);
+static int start_capture(void);
+static ssize_t capture_read(struct file *, char __user *, size_t, loff_t *);
+static ssize_t capture_write(struct file *, const char __user *, size_t, loff_t *);
+static ssize_t capture_log_read(struct file *, char __user *, size_t, loff_t *);
+
+static int lcd_send(const char *, size_t);
+static bool setting_cached(enum controller_setting, unsigned int);
+static void cache_setting(enum controller_setting, unsigned int);
+static void invalidate_controller_cache(void);
+static int write_setting(enum controller_setting, unsigned int, const char *, size_t);
+static char cached_memory_mode(void);
+
+static void mark_dirty(size_t, size_t, size_t);
+static bool damage_bounds(struct flush_window *);
+static size_t window_address_cost(const struct flush_window *);
+static size_t window_cost(const struct flush_window *, char);
+static size_t mode_switch_cost(char);
+static size_t plan_cost(const struct flush_plan *, char);
+static char preferred_mode(const struct flush_plan *);
+static void plan_flush(struct flush_plan *, struct flush_plan *);
+static int flush_page_window(const struct flush_window *);
+static int flush_window(const struct flush_window *, char);
+static void mark_damage(size_t, size_t, size_t);
+static void mark_range_damaged(size_t, size_t);
+static void compose_damage(void);
+static void diff_against_shadow(void);
+static void update_shadow(const struct flush_window *);
+static void merge_windows(struct flush_window *, const struct flush_window *, const struct flush_window *);
+static int try_flush_screen(void);
+static int send_dirty_columns(bool);
+static void record_pixel_time(u32);
+static int flush_screen(void);
+static u64 commit_frame(u32);
+static void flush_committed(struct work_struct *);
+static void complete_frames(u64);
+static void calibrate_flush_cost(void);
+static size_t data_cost(size_t);
+static size_t transfer_limit(void);
+static int send_data(char *, size_t);
+static int self_test_transfer(size_t, u32 *);
+static int self_test_bus(void);
+
+#ifndef LCD_DRIVER_KUNIT
 static int lcd_driver_init(void);
 static void lcd_driver_exit(void);
+#endif
 
 static int lcd_driver_probe(struct i2c_client *, const struct i2c_device_id *);
 static int lcd_driver_remove(struct i2c_client *);
 
+static int lcd_power_get(void);
+static void lcd_power_put(void);
+static int lcd_runtime_suspend(struct device *);
+static int lcd_runtime_resume(struct device *);
+static int power_down_panel(void);
+static int lcd_suspend(struct device *);
+static int lcd_resume(struct device *);
+
+static void record_latency(atomic64_t *, ktime_t);
+static void show_histogram(struct seq_file *, const char *, atomic64_t *);
+static int statistics_show(struct seq_file *, void *);
+static int statistics_open(struct inode *, struct file *);
+static ssize_t statistics_reset_write(struct file *, const char __user *, size_t, loff_t *);
+static void create_debugfs(void);
+
+static u64 decay_average(u64, unsigned long, u64);
+static void sample_bus_load(struct work_struct *);
+static u32 busy_throughput(void);
+static ssize_t show_bus_load_lcd(struct device_driver *, char *);
+static ssize_t show_bus_rate_lcd(struct device_driver *, char *);
+static ssize_t show_bus_capacity_lcd(struct device_driver *, char *);
+static ssize_t show_max_fps_lcd(struct device_driver *, char *);
+
 static ssize_t show_enable_lcd(struct device_driver *, char *);
 static ssize_t store_enable_lcd(struct device_driver *, const char *, size_t);
 
+static ssize_t show_contrast_lcd(struct device_driver *, char *);
+static ssize_t store_contrast_lcd(struct device_driver *, const char *, size_t);
+
 static ssize_t store_display_lcd(struct device_driver *, const char *, size_t);
+static size_t render_text(const char *, size_t);
+static ssize_t store_display_at_lcd(struct device_driver *, const char *, size_t);
+static size_t render_field(char *, size_t, size_t, size_t, const char *, size_t);
+static ssize_t store_overlay_lcd(struct device_driver *, const char *, size_t);
+static void render_overlay(const char *, size_t);
+static void count_overlay_urgency(void);
+
+static ssize_t show_region_lcd(struct device_driver *, char *);
+static ssize_t store_region_lcd(struct device_driver *, const char *, size_t);
+static ssize_t store_region_text_lcd(struct device_driver *, const char *, size_t);
+static struct lcd_region *find_region(const char *);
+static void clear_region(struct lcd_region *);
+static void draw_glyph(char *, const struct lcd_region *, char);
+static size_t render_region(struct lcd_region *, const char *, size_t);
+
+static ssize_t store_draw_lcd(struct device_driver *, const char *, size_t);
+static long draw_layer(struct lcd_layer *, const struct lcd_draw_buffer __user *);
+static int run_draw(char *, const u8 *, size_t);
+static size_t draw_command_size(const u8 *, size_t);
+static bool draw_command(char *, const u8 *);
+static void plot(char *, int, int, enum pixel_operation);
+static void fill_rectangle(char *, int, int, int, int, enum pixel_operation);
+static void draw_line(char *, int, int, int, int);
+static void draw_text(char *, const u8 *);
+static void draw_bitmap(char *, const u8 *);
+
+static ssize_t read_frame_lcd(struct file *, struct kobject *, struct bin_attribute *, char *, loff_t, size_t);
+static ssize_t write_frame_lcd(struct file *, struct kobject *, struct bin_attribute *, char *, loff_t, size_t);
+
+static int layer_open(struct inode *, struct file *);
+static int layer_release(struct inode *, struct file *);
+static ssize_t layer_read(struct file *, char __user *, size_t, loff_t *);
+static ssize_t layer_write(struct file *, const char __user *, size_t, loff_t *);
+static long layer_ioctl(struct file *, unsigned int, unsigned long);
+static __poll_t layer_poll(struct file *, poll_table *);
+static long set_layer(struct lcd_layer *, const struct lcd_layer_info *);
+static long set_mask(struct lcd_layer *, const struct lcd_layer_mask __user *);
+static void init_layer(struct lcd_layer *);
+static void show_layer_for(struct lcd_layer *, u32);
+static enum hrtimer_restart layer_expired(struct hrtimer *);
+static void restore_under_layer(struct work_struct *);
+static void place_layer(struct lcd_layer *);
+static void damage_layer(const struct lcd_layer *);
+
+static long queue_frame(struct lcd_layer *, const struct lcd_timed_frame __user *);
+static void drop_queued_frames(struct lcd_layer *);
+static u64 estimate_present_ns(const struct lcd_layer *);
+static void arm_presentation(void);
+static enum hrtimer_restart presentation_due(struct hrtimer *);
+static void present_frames(struct work_struct *);
+
+static ssize_t show_committed_seq_lcd(struct device *, struct device_attribute *, char *);
+static ssize_t show_flushed_seq_lcd(struct device *, struct device_attribute *, char *);
+
+static void console_write(struct console *, const char *, unsigned int);
+static void repaint_console(struct work_struct *);
+static void render_console(const char *, size_t);
+static void console_newline(void);
+static int write_start_line(unsigned int);
+
+static ssize_t show_bus_frequency_lcd(struct device_driver *, char *);
+static ssize_t show_throughput_lcd(struct device_driver *, char *);
+static ssize_t show_max_transfer_lcd(struct device_driver *, char *);
+static ssize_t show_resume_latency_lcd(struct device_driver *, char *);
 
 /***********************************************************/
 /******************** GLOBAL VARIABLES *********************/
 /***********************************************************/
-static char _screen_buffer[1025];
-static char *screen_buffer = _screen_buffer + 1;
+static char base_layer[SCREEN_BUFFER_SIZE]; // what the sysfs interfaces draw, below every layer
+static char screen_buffer[SCREEN_BUFFER_SIZE] __aligned(sizeof(unsigned long));
+static char shadow_gram[SCREEN_BUFFER_SIZE] __aligned(sizeof(unsigned long));
+static bool shadow_valid = false;
+
+static char _flush_buffer[SCREEN_BUFFER_SIZE + 1];
+static DECLARE_BITMAP(dirty_columns[SCREEN_PAGES], SCREEN_WIDTH);
+static DECLARE_BITMAP(damaged_columns[SCREEN_PAGES], SCREEN_WIDTH); // drawn since the last compose
+static size_t transaction_overhead = DEFAULT_TRANSACTION_OVERHEAD;
+static u64 bytes_sent = 0;
+static u64 transactions_sent = 0;
+static u64 busy_ns = 0;
+
+static const unsigned long load_exponents[LOAD_AVERAGES] = {EXP_1, EXP_5, EXP_15};
+static u64 bus_load[LOAD_AVERAGES];
+static u64 bus_rate[LOAD_AVERAGES];
+static u64 sampled_bytes = 0;
+static u64 sampled_busy_ns = 0;
+static ktime_t sampled_at;
+static DECLARE_DELAYED_WORK(bus_load_work, sample_bus_load);
+
+static struct lcd_statistics statistics;
+static struct dentry *debugfs_driver_root = NULL;
+static struct dentry *debugfs_root = NULL;
+
+static const struct file_operations statistics_fops = {
+    .owner = THIS_MODULE,
+    .open = statistics_open,
+    .read = seq_read,
+    .llseek = seq_lseek,
+    .release = single_release,
+};
+
+static const struct file_operations statistics_reset_fops = {
+    .owner = THIS_MODULE,
+    .write = statistics_reset_write,
+};
+
+static const struct lcd_transport i2c_transport = {
+    .name = "i2c",
+    .send = i2c_transport_send,
+};
+
+static const struct lcd_transport recording_transport = {
+    .name = "recording",
+    .send = recording_transport_send,
+};
+
+static const struct lcd_transport *transport = &i2c_transport;
+static char *recording = NULL;
+static size_t recording_size = 0;
+static bool recording_truncated = false;
+
+static const struct file_operations record_fops = {
+    .owner = THIS_MODULE,
+    .read = record_read,
+    .write = record_write,
+};
+
+static const struct file_operations recording_fops = {
+    .owner = THIS_MODULE,
+    .read = recording_read,
+};
+
+static char *capture_log = NULL;
+static size_t capture_size = 0;
+static bool capturing = false;
+static bool capture_truncated = false;
+static ktime_t captured_at;
+
+static const struct file_operations capture_fops = {
+    .owner = THIS_MODULE,
+    .read = capture_read,
+    .write = capture_write,
+};
+
+static const struct file_operations capture_log_fops = {
+    .owner = THIS_MODULE,
+    .read = capture_log_read,
+};
+
+static LIST_HEAD(layers); // bottom to top
+static bool panel_gone = false; // removed while files were still open, frame_mutex
+static LIST_HEAD(scheduled_frames); // by start time
+static struct hrtimer present_timer;
+static DECLARE_WORK(present_work, present_frames);
+
+// Drawn by the overlay attribute, above every layer of the character device
+static struct lcd_layer text_overlay = {
+    .node = LIST_HEAD_INIT(text_overlay.node),
+    .z = S32_MAX,
+};
+
+static const struct file_operations layer_fops = {
+    .owner = THIS_MODULE,
+    .open = layer_open,
+    .release = layer_release,
+    .read = layer_read,
+    .write = layer_write,
+    .unlocked_ioctl = layer_ioctl,
+    .compat_ioctl = compat_ptr_ioctl,
+    .poll = layer_poll,
+    .llseek = default_llseek,
+};
+
+static struct miscdevice layer_device = {
+    .minor = MISC_DYNAMIC_MINOR,
+    .name = "lcd",
+    .fops = &layer_fops,
+    .mode = 00666,
+};
+static bool layer_device_registered = false;
+static size_t max_transfer = SCREEN_BUFFER_SIZE + 1;
+
+static u32 bus_frequency = DEFAULT_BUS_FREQUENCY;
+static u32 panel_bus_frequency = DEFAULT_BUS_FREQUENCY;
+static u32 measured_throughput = 0;
+
+static u32 autosuspend_delay = DEFAULT_AUTOSUSPEND_DELAY;
+static u32 resume_latency = 0;
+
+// frame_mutex guards what gets drawn (layers, regions, the cursor, damage, the capture log) and
+// lcd_mutex the bus and everything describing the panel. A flush takes frame_mutex inside
+// lcd_mutex only long enough to compose, so writers draw the next frame while this one is sent.
+static DEFINE_MUTEX(lcd_mutex);
+static DEFINE_MUTEX(frame_mutex);
+
+static atomic64_t committed_seq = ATOMIC64_INIT(0);
+static atomic64_t flushed_seq = ATOMIC64_INIT(0);
+static int flush_error = 0; // of the last flush of committed frames
+static DECLARE_WORK(commit_work, flush_committed);
+static DECLARE_WAIT_QUEUE_HEAD(flush_wait);
+
+// High priority commits mark their damage in urgent_columns and raise urgent_pending, which makes
+// a preemptible flush pass give up the bus at its next chunk
+static DECLARE_BITMAP(urgent_columns[SCREEN_PAGES], SCREEN_WIDTH);
+static atomic_t urgent_pending = ATOMIC_INIT(0);
+static atomic_t urgent_layers = ATOMIC_INIT(0); // open files with LCD_PRIORITY_HIGH, the shown overlay
+static bool overlay_urgent = false;              // the overlay is counted in urgent_layers, frame_mutex
+static bool flush_preemptible = false;
+static size_t preemptions_left = 0; // lcd_mutex
+static ktime_t committed_since[UPDATE_PRIORITIES]; // oldest commit not composed yet, frame_mutex
+static ktime_t flushing_since[UPDATE_PRIORITIES];  // oldest commit not on the panel yet, lcd_mutex
+
+static unsigned int controller_cache[CACHED_SETTINGS];
+static DECLARE_BITMAP(controller_cache_valid, CACHED_SETTINGS);
 
 static char lcd_display_state = 0;
+static unsigned char lcd_contrast = (unsigned char)CONTRAST_SETTING;
+static struct lcd_region regions[MAX_REGIONS];
+
 static int x = 0;
 static int y = 0;
 
 static struct i2c_client *lcd_i2c_client = NULL;
 
+static int adapter_number = DEFAULT_ADAPTER_NUMBER;
+module_param(adapter_number, int, 0444);
+MODULE_PARM_DESC(adapter_number, "I2C adapter the panel hangs off, i2c2 on the BeagleBone");
+
+// The console scrolls the whole GRAM with the start line, so while it is enabled every other
+// drawing interface answers EBUSY instead of drawing somewhere the panel no longer shows
+static bool enable_console = false;
+module_param_named(console, enable_console, bool, 0444);
+MODULE_PARM_DESC(console, "Show kernel messages on the panel instead of the drawing interfaces, scrolled with the start line");
+
+static struct console lcd_console = {
+    .name = "lcd",
+    .write = console_write,
+    .flags = CON_PRINTBUFFER,
+    .index = -1,
+};
+
+// printk can call console_write() from any context, it only queues the text for repaint_console()
+static DEFINE_SPINLOCK(console_text_lock);
+static char console_text[CONSOLE_BUFFER_BYTES];
+static size_t console_head = 0;
+static size_t console_tail = 0;
+static DECLARE_DELAYED_WORK(console_work, repaint_console);
+
+// The console writes its lines round the eight GRAM pages and shows four of them through the start
+// line, a new line costs one page instead of redrawing the screen. Guarded by frame_mutex.
+static size_t console_page = 0;
+static size_t console_column = 0;
+static size_t console_top = 0;
+static size_t console_lines = 1;
+static bool console_newline_pending = false;
+static unsigned int start_line = 0; // lcd_mutex
+
 static const struct i2c_device_id i2c_ids[] = {
     {"lcd-driver", 0},
     {} // ends with empty; MUST be last member
@@ -107,19 +599,24 @@ static const struct of_device_id ids[] = {
 
 MODULE_DEVICE_TABLE(i2c, i2c_ids);
 
+static const struct dev_pm_ops lcd_pm_ops = {
+    SET_SYSTEM_SLEEP_PM_OPS(lcd_suspend, lcd_resume)
+    SET_RUNTIME_PM_OPS(lcd_runtime_suspend, lcd_runtime_resume, NULL)};
+
 static struct i2c_driver i2c_driver = {
     .probe = lcd_driver_probe,   // obliged
     .remove = lcd_driver_remove, // obliged
     //  .shutdown            // optional
-    //  .suspend             // optional
+    //  .suspend             // in lcd_pm_ops
     //  .suspend_late        // optional
     //  .resume_early        // optional
-    //  .resume              // optional
+    //  .resume              // in lcd_pm_ops
     .id_table = i2c_ids,
     .driver = {
         .name = "lcd-driver", // name of the driver
         .owner = THIS_MODULE,
         .of_match_table = of_match_ptr(ids),
+        .pm = &lcd_pm_ops,
     },
 };
 
@@ -130,6 +627,41 @@ struct driver_attribute display_attribute = {
         .name = "display",
         .mode = 00222}};
 
+struct driver_attribute overlay_attribute = {
+    .show = NULL,
+    .store = store_overlay_lcd,
+    .attr = {
+        .name = "overlay",
+        .mode = 00222}};
+
+struct driver_attribute display_at_attribute = {
+    .show = NULL,
+    .store = store_display_at_lcd,
+    .attr = {
+        .name = "display_at",
+        .mode = 00222}};
+
+struct driver_attribute region_attribute = {
+    .show = show_region_lcd,
+    .store = store_region_lcd,
+    .attr = {
+        .name = "region",
+        .mode = 00666}};
+
+struct driver_attribute draw_attribute = {
+    .show = NULL,
+    .store = store_draw_lcd,
+    .attr = {
+        .name = "draw",
+        .mode = 00222}};
+
+struct driver_attribute region_text_attribute = {
+    .show = NULL,
+    .store = store_region_text_lcd,
+    .attr = {
+        .name = "region_text",
+        .mode = 00222}};
+
 struct driver_attribute enable_attribute = {
     .show = show_enable_lcd,
     .store = store_enable_lcd,
@@ -137,6 +669,93 @@ struct driver_attribute enable_attribute = {
         .name = "enable",
         .mode = 00666}};
 
+struct device_attribute committed_seq_attribute = {
+    .show = show_committed_seq_lcd,
+    .store = NULL,
+    .attr = {
+        .name = "committed_seq",
+        .mode = 00444}};
+
+struct device_attribute flushed_seq_attribute = {
+    .show = show_flushed_seq_lcd,
+    .store = NULL,
+    .attr = {
+        .name = "flushed_seq",
+        .mode = 00444}};
+
+struct driver_attribute bus_frequency_attribute = {
+    .show = show_bus_frequency_lcd,
+    .store = NULL,
+    .attr = {
+        .name = "bus_frequency",
+        .mode = 00444}};
+
+struct driver_attribute throughput_attribute = {
+    .show = show_throughput_lcd,
+    .store = NULL,
+    .attr = {
+        .name = "throughput",
+        .mode = 00444}};
+
+struct driver_attribute max_transfer_attribute = {
+    .show = show_max_transfer_lcd,
+    .store = NULL,
+    .attr = {
+        .name = "max_transfer",
+        .mode = 00444}};
+
+struct driver_attribute resume_latency_attribute = {
+    .show = show_resume_latency_lcd,
+    .store = NULL,
+    .attr = {
+        .name = "resume_latency_us",
+        .mode = 00444}};
+
+struct driver_attribute bus_load_attribute = {
+    .show = show_bus_load_lcd,
+    .store = NULL,
+    .attr = {
+        .name = "bus_load",
+        .mode = 00444}};
+
+struct driver_attribute bus_rate_attribute = {
+    .show = show_bus_rate_lcd,
+    .store = NULL,
+    .attr = {
+        .name = "bus_rate",
+        .mode = 00444}};
+
+struct driver_attribute bus_capacity_attribute = {
+    .show = show_bus_capacity_lcd,
+    .store = NULL,
+    .attr = {
+        .name = "bus_capacity",
+        .mode = 00444}};
+
+struct driver_attribute max_fps_attribute = {
+    .show = show_max_fps_lcd,
+    .store = NULL,
+    .attr = {
+        .name = "max_fps",
+        .mode = 00444}};
+
+// Raw GRAM bytes, page-major, per device instead of per driver like the text attributes
+struct bin_attribute frame_attribute = {
+    .attr = {
+        .name = "frame",
+        .mode = 00666},
+    .size = SCREEN_BUFFER_SIZE,
+    .read = read_frame_lcd,
+    .write = write_frame_lcd,
+};
+
+struct driver_attribute contrast_attribute = {
+    .show = show_contrast_lcd,
+    .store = store_contrast_lcd,
+    .attr = {
+        .name = "contrast",
+        .mode = 00666}};
+
 const char characters[] = {
     0x00, 0x00, 0x00, 0x00, 0x00, // space
     0x00, 0x00, 0x2f, 0x00, 0x00, // !
@@ -239,201 +858,3693 @@ const char characters[] = {
 /*********************** DRIVER INIT ***********************/
 /***********************************************************/
 
+// The KUnit suite includes this file and brings its own module init
+#ifndef LCD_DRIVER_KUNIT
 module_init(lcd_driver_init);
 module_exit(lcd_driver_exit);
+#endif
 
 /***********************************************************/
 /****************** FUNCTION DEFINITIONS *******************/
 /***********************************************************/
 
 #pragma region helpers
-static void initialize_screen()
+// display is the state the sequence leaves the panel in, lcd_display_state unless it should stay dark
+static int send_init_sequence(unsigned int display)
 {
-    char disable_screen[] = {COMMAND, ENABLE_SCREEN_COMMAND};
-    char charge_pump_enable[] = {COMMAND, PUMP_COMMAND, PUMP_SETTING};
-    char set_clock_div[] = {COMMAND, SET_CLOCK_DIV_COMMAND, CLOCK_DIVIDER_SETTING};
-    char set_mux[] = {COMMAND, SET_MUX_COMMAND, MUX_SETTING};
-    char set_display_offset[] = {COMMAND, SET_DISPLAY_OFFSET_COMMAND, DISPLAY_OFFSET_SETTING};
-    char set_start_line[] = {COMMAND, SET_START_LINE};
-    char set_memory_mode[] = {COMMAND, SET_MEMORY_MODE_COMMAND, MEMORY_MODE_SETTING};
-    char set_comm_remap[] = {COMMAND, SEG_REMAP_COMMAND};
-    char set_comm_scan[] = {COMMAND, SET_COMM_SCAN_COMMAND};
-    char set_comm_pins[] = {COMMAND, SET_COMM_PINS_COMMAND, COMM_PINS_SETTING};
-    char set_contrast[] = {COMMAND, SET_CONTRAST_COMMAND, CONTRAST_SETTING};
-    char set_vcomm_detect[] = {COMMAND, SET_VCOMM_DETECT_COMMAND, VCOMM_DETECT_SETTING};
-    char set_display_resume[] = {COMMAND, SET_DISPLAY_RESUME_COMMAND};
-    char set_display_normal[] = {COMMAND, SET_NORMAL_DISPLAY};
-    char set_precharge[] = {COMMAND, SET_PRECHARGE_COMMAND, PRECHARGE_SETTING};
+    char init_sequence[MAX_INIT_SEQUENCE_BYTES];
+    size_t size = encode_init_sequence(init_sequence, display);
+    int result;
+
+    invalidate_controller_cache();
+
+    result = lcd_send(init_sequence, size);
+    if (result < 0)
+    {
+        return result;
+    }
+
+    cache_setting(CACHED_DISPLAY, display);
+    cache_setting(CACHED_CHARGE_PUMP, PUMP_SETTING);
+    cache_setting(CACHED_START_LINE, start_line);
+    cache_setting(CACHED_MEMORY_MODE, MEMORY_MODE_SETTING);
+    cache_setting(CACHED_CONTRAST, lcd_contrast);
+
+    return 0;
+}
+
+static void initialize_screen(void)
+{
+    send_init_sequence(lcd_display_state);
 
-    i2c_master_send(lcd_i2c_client, disable_screen, sizeof(disable_screen));
-    i2c_master_send(lcd_i2c_client, charge_pump_enable, sizeof(charge_pump_enable));
-    i2c_master_send(lcd_i2c_client, set_clock_div, sizeof(set_clock_div));
-    i2c_master_send(lcd_i2c_client, set_mux, sizeof(set_mux));
-    i2c_master_send(lcd_i2c_client, set_display_offset, sizeof(set_display_offset));
-    i2c_master_send(lcd_i2c_client, set_start_line, sizeof(set_start_line));
-    i2c_master_send(lcd_i2c_client, set_memory_mode, sizeof(set_memory_mode));
-    i2c_master_send(lcd_i2c_client, set_comm_remap, sizeof(set_comm_remap));
-    i2c_master_send(lcd_i2c_client, set_comm_scan, sizeof(set_comm_scan));
-    i2c_master_send(lcd_i2c_client, set_comm_pins, sizeof(set_comm_pins));
-    i2c_master_send(lcd_i2c_client, set_contrast, sizeof(set_contrast));
-    i2c_master_send(lcd_i2c_client, set_vcomm_detect, sizeof(set_vcomm_detect));
-    i2c_master_send(lcd_i2c_client, set_display_resume, sizeof(set_display_resume));
-    i2c_master_send(lcd_i2c_client, set_display_normal, sizeof(set_display_normal));
-    i2c_master_send(lcd_i2c_client, set_precharge, sizeof(set_precharge));
+    mutex_lock(&frame_mutex);
     reset_screen();
+    mutex_unlock(&frame_mutex);
+
+    write_buffer_to_screen();
 }
 
 static void reset_screen(void)
 {
-    int i;
+    size_t page;
+    size_t column;
 
-    for (i = 0; i < 1024; i++)
+    for (page = 0; page < SCREEN_PAGES; page++)
     {
-        ((char *)screen_buffer)[i] = (char)0x00;
+        for (column = 0; column < SCREEN_WIDTH; column++)
+        {
+            if (base_layer[column + (SCREEN_WIDTH * page)] != (char)0x00)
+            {
+                base_layer[column + (SCREEN_WIDTH * page)] = (char)0x00;
+                mark_damage(page, column, column);
+            }
+        }
     }
 
-    write_buffer_to_screen();
+    reset_cursor();
 }
 
 static void reset_cursor(void)
 {
-    char set_cursor_at_first_page[] = {COMMAND, SET_PAGE_ADDRESS_COMMAND, PAGE_START, PAGE_END};
-    char set_cursor_at_first_column[] = {COMMAND, SET_COLUMN_START_ADDRESS, FIRST_COLUMN, LAST_COLUMN};
-
-    i2c_master_send(lcd_i2c_client, set_cursor_at_first_page, sizeof(set_cursor_at_first_page));
-    i2c_master_send(lcd_i2c_client, set_cursor_at_first_column, sizeof(set_cursor_at_first_column));
-
     x = y = 0;
 }
 
 static void write_buffer_to_screen(void)
 {
-    reset_cursor();
-    _screen_buffer[0] = DATA;
-    i2c_master_send(lcd_i2c_client, _screen_buffer, 1025);
-    reset_cursor();
+    shadow_valid = false;
+    flush_screen();
 }
 #pragma endregion
 
-#pragma region driver_init
-static int lcd_driver_init(void)
+#pragma region encoding
+// The encoders only fill in bytes, sending them is left to lcd_send and the active transport
+static size_t encode_init_sequence(char *init_sequence, unsigned int display)
 {
-    u32 buffer = 0x00;
-
-    printk(KERN_ALERT "eindopracht init");
-
-    struct i2c_adapter *lcd_i2c_adapter = i2c_get_adapter(2);
-
-    struct device_node *i2c2_node = lcd_i2c_adapter->dev.of_node;
-    struct device_node *lcd_node = of_find_node_by_name(i2c2_node, "lcd_driver");
+    char disable_screen[] = {COMMAND, ENABLE_SCREEN_COMMAND};
+    char charge_pump_enable[] = {COMMAND, PUMP_COMMAND, PUMP_SETTING};
+    char set_clock_div[] = {COMMAND, SET_CLOCK_DIV_COMMAND, CLOCK_DIVIDER_SETTING};
+    char set_mux[] = {COMMAND, SET_MUX_COMMAND, MUX_SETTING};
+    char set_display_offset[] = {COMMAND, SET_DISPLAY_OFFSET_COMMAND, DISPLAY_OFFSET_SETTING};
+    char set_start_line[] = {COMMAND, (char)(SET_START_LINE | start_line)};
+    char set_memory_mode[] = {COMMAND, SET_MEMORY_MODE_COMMAND, MEMORY_MODE_SETTING};
+    char set_comm_remap[] = {COMMAND, SEG_REMAP_COMMAND};
+    char set_comm_scan[] = {COMMAND, SET_COMM_SCAN_COMMAND};
+    char set_comm_pins[] = {COMMAND, SET_COMM_PINS_COMMAND, COMM_PINS_SETTING};
+    char set_contrast[] = {COMMAND, SET_CONTRAST_COMMAND, CONTRAST_SETTING};
+    char set_vcomm_detect[] = {COMMAND, SET_VCOMM_DETECT_COMMAND, VCOMM_DETECT_SETTING};
+    char set_display_resume[] = {COMMAND, SET_DISPLAY_RESUME_COMMAND};
+    char set_display_normal[] = {COMMAND, SET_NORMAL_DISPLAY};
+    char set_precharge[] = {COMMAND, SET_PRECHARGE_COMMAND, PRECHARGE_SETTING};
 
-    of_property_read_u32(lcd_node, "i2c-address", &buffer);
+    char enable_screen[] = {COMMAND, ENABLE_SCREEN_COMMAND};
+    size_t size = 1;
 
-    struct i2c_board_info lcd_i2c_board_info = {
-        .type = "lcd-driver",
-        .addr = buffer,
-    };
+    init_sequence[0] = COMMAND;
+    set_contrast[2] = (char)lcd_contrast;
+    enable_screen[1] |= display;
 
-    i2c_new_client_device(lcd_i2c_adapter, &lcd_i2c_board_info);
-    i2c_add_driver(&i2c_driver);
+    batch_command(init_sequence, &size, disable_screen, sizeof(disable_screen));
+    batch_command(init_sequence, &size, charge_pump_enable, sizeof(charge_pump_enable));
+    batch_command(init_sequence, &size, set_clock_div, sizeof(set_clock_div));
+    batch_command(init_sequence, &size, set_mux, sizeof(set_mux));
+    batch_command(init_sequence, &size, set_display_offset, sizeof(set_display_offset));
+    batch_command(init_sequence, &size, set_start_line, sizeof(set_start_line));
+    batch_command(init_sequence, &size, set_memory_mode, sizeof(set_memory_mode));
+    batch_command(init_sequence, &size, set_comm_remap, sizeof(set_comm_remap));
+    batch_command(init_sequence, &size, set_comm_scan, sizeof(set_comm_scan));
+    batch_command(init_sequence, &size, set_comm_pins, sizeof(set_comm_pins));
+    batch_command(init_sequence, &size, set_contrast, sizeof(set_contrast));
+    batch_command(init_sequence, &size, set_vcomm_detect, sizeof(set_vcomm_detect));
+    batch_command(init_sequence, &size, set_display_resume, sizeof(set_display_resume));
+    batch_command(init_sequence, &size, set_display_normal, sizeof(set_display_normal));
+    batch_command(init_sequence, &size, set_precharge, sizeof(set_precharge));
+    batch_command(init_sequence, &size, enable_screen, sizeof(enable_screen));
 
-    return 0;
+    return size;
 }
 
-static void lcd_driver_exit(void)
+// Appends a command without its COMMAND control byte to a batch that already starts with one
+static void batch_command(char *batch, size_t *size, const char *command, size_t command_size)
 {
-    printk(KERN_ALERT "eindopdracht exit");
+    memcpy(batch + *size, command + 1, command_size - 1);
+    *size += command_size - 1;
+}
 
-    i2c_del_driver(&i2c_driver);
-    i2c_unregister_device(lcd_i2c_client);
+static void encode_page_position(char *set_position, size_t page, size_t column)
+{
+    set_position[0] = COMMAND;
+    set_position[1] = SET_PAGE_START_COMMAND | (char)page;
+    set_position[2] = SET_LOWER_COLUMN_COMMAND | (char)(column & 0x0F);
+    set_position[3] = SET_HIGHER_COLUMN_COMMAND | (char)(column >> 4);
 }
-#pragma endregion
 
-#pragma region platform_driver_init
-static int lcd_driver_probe(struct i2c_client *client, const struct i2c_device_id *id)
+// Leaves out the ranges the panel already holds, returns 1 when there is nothing to send
+static size_t encode_window_address(char *set_window, const struct flush_window *window)
 {
-    lcd_i2c_client = client;
+    size_t size = 1;
 
-    initialize_screen();
+    set_window[0] = COMMAND;
 
-    printk(KERN_ALERT "eindopdracht inserting attributes");
-    driver_create_file(&(i2c_driver.driver), &display_attribute);
-    driver_create_file(&(i2c_driver.driver), &enable_attribute);
+    if (!setting_cached(CACHED_PAGE_WINDOW, window->first_page | (window->last_page << 8)))
+    {
+        set_window[size++] = SET_PAGE_ADDRESS_COMMAND;
+        set_window[size++] = (char)window->first_page;
+        set_window[size++] = (char)window->last_page;
+    }
 
-    return 0;
+    if (!setting_cached(CACHED_COLUMN_WINDOW, window->first_column | (window->last_column << 8)))
+    {
+        set_window[size++] = SET_COLUMN_START_ADDRESS;
+        set_window[size++] = (char)window->first_column;
+        set_window[size++] = (char)window->last_column;
+    }
+
+    return size;
 }
 
-static int lcd_driver_remove(struct i2c_client *client)
+// Gathers the window from the back buffer in the order the memory mode walks GRAM
+static size_t encode_window_data(char *data, const struct flush_window *window, char mode)
 {
-    printk(KERN_ALERT "eindopracht removing attributes");
-    driver_remove_file(&(i2c_driver.driver), &display_attribute);
-    driver_remove_file(&(i2c_driver.driver), &enable_attribute);
-    return 0;
+    size_t columns = window->last_column - window->first_column + 1;
+    char *start = data;
+    size_t page;
+    size_t column;
+
+    if (mode == VERTICAL_ADDRESSING)
+    {
+        for (column = window->first_column; column <= window->last_column; column++)
+        {
+            for (page = window->first_page; page <= window->last_page; page++)
+            {
+                *data++ = screen_buffer[column + (SCREEN_WIDTH * page)];
+            }
+        }
+    }
+    else
+    {
+        for (page = window->first_page; page <= window->last_page; page++)
+        {
+            memcpy(data, screen_buffer + window->first_column + (SCREEN_WIDTH * page), columns);
+            data += columns;
+        }
+    }
+
+    return data - start;
 }
 #pragma endregion
 
-#pragma region enable_lcd
-static ssize_t show_enable_lcd(struct device_driver *device, char *buffer)
+#pragma region transport
+static int i2c_transport_send(const char *buffer, size_t size)
 {
-    return sprintf(buffer, "%u\n", lcd_display_state);
+    return i2c_master_send(lcd_i2c_client, buffer, size);
 }
 
-static ssize_t store_enable_lcd(struct device_driver *device, const char *buffer, size_t size)
+// Keeps a copy of every transaction in the format of ssd1306.h and still sends it to the panel
+static int recording_transport_send(const char *buffer, size_t size)
 {
-    char send_buffer[2] = {COMMAND, ENABLE_SCREEN_COMMAND};
-    ssize_t result = -1;
-
-    if (buffer[0] == '0')
+    if (recording_size + RECORD_HEADER_BYTES + size <= RECORDING_BYTES)
     {
-        lcd_display_state = 0;
+        recording[recording_size++] = (char)(size & 0xFF);
+        recording[recording_size++] = (char)(size >> 8);
+        memcpy(recording + recording_size, buffer, size);
+        recording_size += size;
     }
-    else if (buffer[0] == '1')
+    else
+    {
+        recording_truncated = true;
+    }
+
+    return i2c_transport_send(buffer, size);
+}
+
+static int start_recording(void)
+{
+    if (recording == NULL)
+    {
+        recording = vmalloc(RECORDING_BYTES);
+        if (recording == NULL)
+        {
+            return -ENOMEM;
+        }
+    }
+
+    recording_size = 0;
+    recording_truncated = false;
+    transport = &recording_transport;
+    return 0;
+}
+
+static void stop_recording(void)
+{
+    transport = &i2c_transport;
+}
+
+static ssize_t record_read(struct file *file, char __user *buffer, size_t size, loff_t *offset)
+{
+    char state[32];
+    int length = scnprintf(state, sizeof(state), "%s %zu%s\n", transport->name, recording_size,
+                           recording_truncated ? " truncated" : "");
+
+    return simple_read_from_buffer(buffer, size, offset, state, length);
+}
+
+// Writing 1 starts a fresh recording, 0 stops it and leaves it readable
+static ssize_t record_write(struct file *file, const char __user *buffer, size_t size, loff_t *offset)
+{
+    bool enable;
+    int result = kstrtobool_from_user(buffer, size, &enable);
+
+    if (result < 0)
+    {
+        return result;
+    }
+
+    mutex_lock(&lcd_mutex);
+    if (enable)
+    {
+        result = start_recording();
+    }
+    else
+    {
+        stop_recording();
+    }
+    mutex_unlock(&lcd_mutex);
+
+    return result < 0 ? result : size;
+}
+
+static ssize_t recording_read(struct file *file, char __user *buffer, size_t size, loff_t *offset)
+{
+    ssize_t result = 0;
+
+    mutex_lock(&lcd_mutex);
+    if (recording != NULL)
+    {
+        result = simple_read_from_buffer(buffer, size, offset, recording, recording_size);
+    }
+    mutex_unlock(&lcd_mutex);
+
+    return result;
+}
+#pragma endregion
+
+#pragma region capture
+// Appends a request in the format of lcd_capture.h, called under frame_mutex so the log has the
+// order the driver handled the requests in. Only frame requests carry their offset.
+static void capture_request(enum capture_interface interface, loff_t offset, const char *payload, size_t size)
+{
+    size_t offset_bytes = interface == CAPTURE_FRAME ? CAPTURE_OFFSET_BYTES : 0;
+    ktime_t now = ktime_get();
+    u32 delta_us;
+
+    if (!capturing)
+    {
+        return;
+    }
+
+    size = min_t(size_t, size, CAPTURE_MAX_PAYLOAD - offset_bytes);
+    if (capture_size + CAPTURE_HEADER_BYTES + offset_bytes + size > CAPTURE_BYTES)
+    {
+        capture_truncated = true;
+        return;
+    }
+
+    delta_us = capture_size == CAPTURE_MAGIC_BYTES ? 0 : (u32)min_t(s64, ktime_us_delta(now, captured_at), U32_MAX);
+    captured_at = now;
+
+    capture_log[capture_size++] = (char)(delta_us & 0xFF);
+    capture_log[capture_size++] = (char)((delta_us >> 8) & 0xFF);
+    capture_log[capture_size++] = (char)((delta_us >> 16) & 0xFF);
+    capture_log[capture_size++] = (char)(delta_us >> 24);
+    capture_log[capture_size++] = (char)interface;
+    capture_log[capture_size++] = (char)((size + offset_bytes) & 0xFF);
+    capture_log[capture_size++] = (char)((size + offset_bytes) >> 8);
+
+    if (offset_bytes > 0)
+    {
+        capture_log[capture_size++] = (char)(offset & 0xFF);
+        capture_log[capture_size++] = (char)(offset >> 8);
+    }
+
+    memcpy(capture_log + capture_size, payload, size);
+    capture_size += size;
+}
+
+static int start_capture(void)
+{
+    if (capture_log == NULL)
+    {
+        capture_log = vmalloc(CAPTURE_BYTES);
+        if (capture_log == NULL)
+        {
+            return -ENOMEM;
+        }
+    }
+
+    memcpy(capture_log, CAPTURE_MAGIC, CAPTURE_MAGIC_BYTES);
+    capture_size = CAPTURE_MAGIC_BYTES;
+    capture_truncated = false;
+    capturing = true;
+    return 0;
+}
+
+static ssize_t capture_read(struct file *file, char __user *buffer, size_t size, loff_t *offset)
+{
+    char state[32];
+    int length = scnprintf(state, sizeof(state), "%d %zu%s\n", capturing, capture_size,
+                           capture_truncated ? " truncated" : "");
+
+    return simple_read_from_buffer(buffer, size, offset, state, length);
+}
+
+// Writing 1 starts a fresh capture, 0 stops it and leaves the log readable
+static ssize_t capture_write(struct file *file, const char __user *buffer, size_t size, loff_t *offset)
+{
+    bool enable;
+    int result = kstrtobool_from_user(buffer, size, &enable);
+
+    if (result < 0)
+    {
+        return result;
+    }
+
+    mutex_lock(&frame_mutex);
+    if (enable)
+    {
+        result = start_capture();
+    }
+    else
+    {
+        capturing = false;
+    }
+    mutex_unlock(&frame_mutex);
+
+    return result < 0 ? result : size;
+}
+
+static ssize_t capture_log_read(struct file *file, char __user *buffer, size_t size, loff_t *offset)
+{
+    ssize_t result = 0;
+
+    mutex_lock(&frame_mutex);
+    if (capture_log != NULL)
+    {
+        result = simple_read_from_buffer(buffer, size, offset, capture_log, capture_size);
+    }
+    mutex_unlock(&frame_mutex);
+
+    return result;
+}
+#pragma endregion
+
+#pragma region controller_cache
+// Every transfer goes through here so a failed one drops everything assumed about the panel
+static int lcd_send(const char *buffer, size_t size)
+{
+    ktime_t start = ktime_get();
+    int result = transport->send(buffer, size);
+
+    busy_ns += ktime_to_ns(ktime_sub(ktime_get(), start));
+    transactions_sent++;
+    atomic64_inc(&statistics.transactions);
+
+    if (result != (int)size)
+    {
+        atomic64_inc(&statistics.i2c_errors);
+        trace_lcd_i2c_error(size, result);
+        invalidate_controller_cache();
+        shadow_valid = false;
+        return result < 0 ? result : -EIO;
+    }
+
+    bytes_sent += size;
+    atomic64_add(size, &statistics.bytes);
+    return 0;
+}
+
+static bool setting_cached(enum controller_setting setting, unsigned int value)
+{
+    return test_bit(setting, controller_cache_valid) && controller_cache[setting] == value;
+}
+
+static void cache_setting(enum controller_setting setting, unsigned int value)
+{
+    controller_cache[setting] = value;
+    __set_bit(setting, controller_cache_valid);
+}
+
+static void invalidate_controller_cache(void)
+{
+    bitmap_zero(controller_cache_valid, CACHED_SETTINGS);
+}
+
+static int write_setting(enum controller_setting setting, unsigned int value, const char *command, size_t size)
+{
+    int result;
+
+    if (setting_cached(setting, value))
+    {
+        return 0;
+    }
+
+    result = lcd_send(command, size);
+    if (result < 0)
+    {
+        return result;
+    }
+
+    cache_setting(setting, value);
+    return 0;
+}
+
+static char cached_memory_mode(void)
+{
+    if (!test_bit(CACHED_MEMORY_MODE, controller_cache_valid))
+    {
+        return MEMORY_MODE_SETTING;
+    }
+
+    return (char)controller_cache[CACHED_MEMORY_MODE];
+}
+#pragma endregion
+
+#pragma region flush_planner
+static void mark_dirty(size_t page, size_t first_column, size_t last_column)
+{
+    bitmap_set(dirty_columns[page], first_column, last_column - first_column + 1);
+}
+
+// What the renderers mark, compose_damage() turns it into dirty columns for the planner
+static void mark_damage(size_t page, size_t first_column, size_t last_column)
+{
+    bitmap_set(damaged_columns[page], first_column, last_column - first_column + 1);
+}
+
+static bool damage_bounds(struct flush_window *bounds)
+{
+    size_t page;
+    size_t first;
+    bool damaged = false;
+
+    *bounds = (struct flush_window){SCREEN_PAGES, 0, SCREEN_WIDTH, 0};
+
+    for (page = 0; page < SCREEN_PAGES; page++)
+    {
+        first = find_first_bit(damaged_columns[page], SCREEN_WIDTH);
+        if (first >= SCREEN_WIDTH)
+        {
+            continue;
+        }
+
+        bounds->first_page = min(bounds->first_page, page);
+        bounds->last_page = page;
+        bounds->first_column = min(bounds->first_column, first);
+        bounds->last_column = max(bounds->last_column, find_last_bit(damaged_columns[page], SCREEN_WIDTH));
+        damaged = true;
+    }
+
+    return damaged;
+}
+
+// Ranges the controller already holds are not resent, a fully cached window needs no addressing
+static size_t window_address_cost(const struct flush_window *window)
+{
+    bool pages_cached = setting_cached(CACHED_PAGE_WINDOW, window->first_page | (window->last_page << 8));
+    bool columns_cached = setting_cached(CACHED_COLUMN_WINDOW, window->first_column | (window->last_column << 8));
+
+    if (pages_cached && columns_cached)
+    {
+        return 0;
+    }
+
+    return 1 + transaction_overhead + (pages_cached ? 0 : RANGE_COMMAND_BYTES) + (columns_cached ? 0 : RANGE_COMMAND_BYTES);
+}
+
+// Bytes on the wire for one window: an addressing transaction and a data transaction,
+// repeated for every page when the controller is in page addressing mode
+static size_t window_cost(const struct flush_window *window, char mode)
+{
+    size_t pages = window->last_page - window->first_page + 1;
+    size_t columns = window->last_column - window->first_column + 1;
+
+    if (mode == PAGE_ADDRESSING)
+    {
+        return pages * (PAGE_ADDRESS_BYTES + transaction_overhead + data_cost(columns));
+    }
+
+    if (setting_cached(CACHED_MEMORY_MODE, mode))
+    {
+        return window_address_cost(window) + data_cost(pages * columns);
+    }
+
+    return WINDOW_ADDRESS_BYTES + transaction_overhead + data_cost(pages * columns);
+}
+
+// Data is split into transactions of at most transfer_limit() bytes, each with its own DATA byte
+static size_t data_cost(size_t size)
+{
+    return size + (DIV_ROUND_UP(size, transfer_limit() - 1) * (1 + transaction_overhead));
+}
+
+// While a high priority layer is open or an overlay is shown the preemptible pass keeps its
+// transfers short, otherwise an alert could still wait behind a complete frame sent in one transaction
+static size_t transfer_limit(void)
+{
+    if (flush_preemptible && atomic_read(&urgent_layers) > 0)
+    {
+        return min(max_transfer, PREEMPT_CHUNK_BYTES + 1);
+    }
+
+    return max_transfer;
+}
+
+static size_t mode_switch_cost(char mode)
+{
+    return setting_cached(CACHED_MEMORY_MODE, mode) ? 0 : MEMORY_MODE_BYTES + transaction_overhead;
+}
+
+static size_t plan_cost(const struct flush_plan *plan, char mode)
+{
+    size_t i;
+    size_t cost = mode_switch_cost(mode);
+
+    for (i = 0; i < plan->window_count; i++)
+    {
+        cost += window_cost(&plan->windows[i], mode);
+    }
+
+    return cost;
+}
+
+static void merge_windows(struct flush_window *merged, const struct flush_window *a, const struct flush_window *b)
+{
+    merged->first_page = min(a->first_page, b->first_page);
+    merged->last_page = max(a->last_page, b->last_page);
+    merged->first_column = min(a->first_column, b->first_column);
+    merged->last_column = max(a->last_column, b->last_column);
+}
+
+// Narrow, tall damage is written column by column, everything else row by row
+static char preferred_mode(const struct flush_plan *plan)
+{
+    size_t i;
+    size_t pages;
+    size_t columns;
+
+    for (i = 0; i < plan->window_count; i++)
+    {
+        pages = plan->windows[i].last_page - plan->windows[i].first_page + 1;
+        columns = plan->windows[i].last_column - plan->windows[i].first_column + 1;
+
+        if (pages * 8 <= columns)
+        {
+            return HORIZONTAL_ADDRESSING;
+        }
+    }
+
+    return VERTICAL_ADDRESSING;
+}
+
+static void plan_flush(struct flush_plan *plan, struct flush_plan *rows)
+{
+    struct flush_window bounds = {SCREEN_PAGES, 0, SCREEN_WIDTH, 0};
+    struct flush_window merged;
+    struct flush_window *window;
+    size_t page;
+    size_t start;
+    size_t end;
+    size_t i;
+    size_t j;
+    size_t best_i = 0;
+    size_t best_j = 0;
+    ssize_t saving;
+    ssize_t best_saving;
+    size_t gap_limit = WINDOW_ADDRESS_BYTES + 1 + (2 * transaction_overhead);
+    char memory_mode = cached_memory_mode();
+
+    plan->window_count = 0;
+    plan->memory_mode = memory_mode;
+    plan->cost = 0;
+
+    // One window per dirty run, bridging gaps that are cheaper to resend than to readdress
+    for (page = 0; page < SCREEN_PAGES; page++)
+    {
+        start = find_first_bit(dirty_columns[page], SCREEN_WIDTH);
+
+        while (start < SCREEN_WIDTH)
+        {
+            end = find_next_zero_bit(dirty_columns[page], SCREEN_WIDTH, start) - 1;
+            window = plan->window_count ? &plan->windows[plan->window_count - 1] : NULL;
+
+            if (window && window->first_page == page && start - window->last_column - 1 < gap_limit)
+            {
+                window->last_column = end;
+            }
+            else if (plan->window_count == MAX_FLUSH_WINDOWS)
+            {
+                merge_windows(window, window, &(struct flush_window){page, page, start, end});
+            }
+            else
+            {
+                plan->windows[plan->window_count++] = (struct flush_window){page, page, start, end};
+            }
+
+            merge_windows(&bounds, &bounds, &(struct flush_window){page, page, start, end});
+            start = find_next_bit(dirty_columns[page], SCREEN_WIDTH, end + 1);
+        }
+    }
+
+    if (plan->window_count == 0)
+    {
+        return;
+    }
+
+    *rows = *plan;
+    rows->memory_mode = PAGE_ADDRESSING;
+    rows->cost = plan_cost(rows, PAGE_ADDRESSING);
+
+    // Greedily merge the pair of windows that saves the most bytes until no merge pays off
+    for (;;)
+    {
+        best_saving = 0;
+
+        for (i = 0; i < plan->window_count; i++)
+        {
+            for (j = i + 1; j < plan->window_count; j++)
+            {
+                merge_windows(&merged, &plan->windows[i], &plan->windows[j]);
+                saving = (ssize_t)(window_cost(&plan->windows[i], HORIZONTAL_ADDRESSING) +
+                                   window_cost(&plan->windows[j], HORIZONTAL_ADDRESSING)) -
+                         (ssize_t)window_cost(&merged, HORIZONTAL_ADDRESSING);
+
+                if (saving > best_saving)
+                {
+                    best_saving = saving;
+                    best_i = i;
+                    best_j = j;
+                }
+            }
+        }
+
+        if (best_saving <= 0)
+        {
+            break;
+        }
+
+        merge_windows(&plan->windows[best_i], &plan->windows[best_i], &plan->windows[best_j]);
+        plan->windows[best_j] = plan->windows[--plan->window_count];
+    }
+
+    if (window_cost(&bounds, HORIZONTAL_ADDRESSING) <=
+        plan_cost(plan, HORIZONTAL_ADDRESSING) - mode_switch_cost(HORIZONTAL_ADDRESSING))
+    {
+        plan->windows[0] = bounds;
+        plan->window_count = 1;
+    }
+
+    // Horizontal and vertical windows move the same data bytes, so the damage shape picks
+    // between them and only a mode switch can make the other one cheaper
+    plan->memory_mode = preferred_mode(plan);
+    plan->cost = plan_cost(plan, plan->memory_mode);
+
+    if (plan_cost(plan, memory_mode) < plan->cost)
+    {
+        plan->memory_mode = memory_mode;
+        plan->cost = plan_cost(plan, memory_mode);
+    }
+
+    // Page addressing skips the end registers, which pays off for edits confined to single pages
+    if (rows->cost < plan->cost)
+    {
+        *plan = *rows;
+    }
+}
+
+static int flush_page_window(const struct flush_window *window)
+{
+    char set_position[PAGE_ADDRESS_BYTES];
+    size_t columns = window->last_column - window->first_column + 1;
+    size_t page;
+    int result;
+
+    for (page = window->first_page; page <= window->last_page; page++)
+    {
+        encode_page_position(set_position, page, window->first_column);
+        memcpy(_flush_buffer + 1, screen_buffer + window->first_column + (SCREEN_WIDTH * page), columns);
+
+        if (lcd_send(set_position, sizeof(set_position)) < 0)
+        {
+            return -EIO;
+        }
+
+        result = send_data(_flush_buffer, columns);
+        if (result < 0)
+        {
+            return result;
+        }
+    }
+
+    // The position commands move the write pointer away from any cached window start
+    __clear_bit(CACHED_PAGE_WINDOW, controller_cache_valid);
+    __clear_bit(CACHED_COLUMN_WINDOW, controller_cache_valid);
+
+    return 0;
+}
+
+static int flush_window(const struct flush_window *window, char mode)
+{
+    unsigned int pages = window->first_page | (window->last_page << 8);
+    unsigned int column_range = window->first_column | (window->last_column << 8);
+    char set_window[WINDOW_ADDRESS_BYTES];
+    size_t set_window_size;
+    size_t data_size;
+
+    if (mode == PAGE_ADDRESSING)
+    {
+        return flush_page_window(window);
+    }
+
+    data_size = encode_window_data(_flush_buffer + 1, window, mode);
+
+    // A completely written window leaves the write pointer at its start, so a cached one is reused as is
+    set_window_size = encode_window_address(set_window, window);
+    if (set_window_size > 1)
+    {
+        if (lcd_send(set_window, set_window_size) < 0)
+        {
+            return -EIO;
+        }
+
+        cache_setting(CACHED_PAGE_WINDOW, pages);
+        cache_setting(CACHED_COLUMN_WINDOW, column_range);
+    }
+
+    return send_data(_flush_buffer, data_size);
+}
+
+// Marks size bytes of the buffer layout from offset on, wrapping into the next pages
+static void mark_range_damaged(size_t offset, size_t size)
+{
+    size_t last = offset + size - 1;
+    size_t page;
+
+    for (page = offset / SCREEN_WIDTH; page <= last / SCREEN_WIDTH; page++)
+    {
+        mark_damage(page, page == offset / SCREEN_WIDTH ? offset % SCREEN_WIDTH : 0,
+                   page == last / SCREEN_WIDTH ? last % SCREEN_WIDTH : SCREEN_WIDTH - 1);
+    }
+}
+
+// Rebuilds the damaged columns of the back buffer from the base layer and the visible layers on
+// top of it and hands them to the planner, the rest of the back buffer is already up to date
+static void compose_damage(void)
+{
+    const struct lcd_layer *layer;
+    size_t page;
+    size_t column;
+    size_t offset;
+    char pixels;
+
+    for (page = 0; page < SCREEN_PAGES; page++)
+    {
+        for_each_set_bit(column, damaged_columns[page], SCREEN_WIDTH)
+        {
+            offset = column + (SCREEN_WIDTH * page);
+            pixels = base_layer[offset];
+
+            list_for_each_entry(layer, &layers, node)
+            {
+                if (layer->visible)
+                {
+                    pixels = (pixels & ~layer->mask[offset]) | (layer->pixels[offset] & layer->mask[offset]);
+                }
+            }
+
+            screen_buffer[offset] = pixels;
+        }
+
+        bitmap_or(dirty_columns[page], dirty_columns[page], damaged_columns[page], SCREEN_WIDTH);
+        bitmap_zero(damaged_columns[page], SCREEN_WIDTH);
+    }
+}
+
+// Replace the dirty bitmap with the columns that differ from what the panel holds
+static void diff_against_shadow(void)
+{
+    const unsigned long *back;
+    const unsigned long *shadow;
+    size_t page;
+    size_t word;
+    size_t column;
+
+    for (page = 0; page < SCREEN_PAGES; page++)
+    {
+        back = (const unsigned long *)(screen_buffer + (SCREEN_WIDTH * page));
+        shadow = (const unsigned long *)(shadow_gram + (SCREEN_WIDTH * page));
+
+        bitmap_zero(dirty_columns[page], SCREEN_WIDTH);
+
+        for (word = 0; word < SCREEN_WIDTH / sizeof(unsigned long); word++)
+        {
+            if (back[word] == shadow[word])
+            {
+                continue;
+            }
+
+            for (column = word * sizeof(unsigned long); column < (word + 1) * sizeof(unsigned long); column++)
+            {
+                if (screen_buffer[column + (SCREEN_WIDTH * page)] != shadow_gram[column + (SCREEN_WIDTH * page)])
+                {
+                    __set_bit(column, dirty_columns[page]);
+                }
+            }
+        }
+    }
+}
+
+static void update_shadow(const struct flush_window *window)
+{
+    size_t columns = window->last_column - window->first_column + 1;
+    size_t offset;
+    size_t page;
+
+    for (page = window->first_page; page <= window->last_page; page++)
+    {
+        offset = window->first_column + (SCREEN_WIDTH * page);
+        memcpy(shadow_gram + offset, screen_buffer + offset, columns);
+    }
+}
+
+static int try_flush_screen(void)
+{
+    // Kept off the stack, flush_screen() only runs under lcd_mutex
+    static DECLARE_BITMAP(urgent[SCREEN_PAGES], SCREEN_WIDTH);
+    static DECLARE_BITMAP(deferred[SCREEN_PAGES], SCREEN_WIDTH);
+    u64 sequence;
+    size_t page;
+    size_t priority;
+    bool has_urgent = false;
+    int windows;
+    int result;
+
+    mutex_lock(&frame_mutex);
+    if (!shadow_valid)
+    {
+        for (page = 0; page < SCREEN_PAGES; page++)
+        {
+            mark_damage(page, 0, SCREEN_WIDTH - 1);
+        }
+    }
+
+    sequence = atomic64_read(&committed_seq);
+    compose_damage();
+
+    for (page = 0; page < SCREEN_PAGES; page++)
+    {
+        bitmap_copy(urgent[page], urgent_columns[page], SCREEN_WIDTH);
+        bitmap_zero(urgent_columns[page], SCREEN_WIDTH);
+    }
+    atomic_set(&urgent_pending, 0);
+
+    for (priority = 0; priority < UPDATE_PRIORITIES; priority++)
+    {
+        if (committed_since[priority] != 0 &&
+            (flushing_since[priority] == 0 || ktime_before(committed_since[priority], flushing_since[priority])))
+        {
+            flushing_since[priority] = committed_since[priority];
+        }
+
+        committed_since[priority] = 0;
+    }
+    mutex_unlock(&frame_mutex);
+
+    if (shadow_valid)
+    {
+        diff_against_shadow();
+    }
+
+    // What high priority commits drew goes out first and is never preempted, the rest after it
+    for (page = 0; page < SCREEN_PAGES; page++)
+    {
+        bitmap_andnot(deferred[page], dirty_columns[page], urgent[page], SCREEN_WIDTH);
+        has_urgent |= bitmap_and(dirty_columns[page], dirty_columns[page], urgent[page], SCREEN_WIDTH) != 0;
+    }
+
+    windows = has_urgent ? send_dirty_columns(false) : 0;
+    if (windows < 0)
+    {
+        return windows;
+    }
+
+    if (has_urgent)
+    {
+        record_pixel_time(LCD_PRIORITY_HIGH);
+    }
+
+    for (page = 0; page < SCREEN_PAGES; page++)
+    {
+        bitmap_copy(dirty_columns[page], deferred[page], SCREEN_WIDTH);
+    }
+
+    result = send_dirty_columns(true);
+    if (result < 0)
+    {
+        return result;
+    }
+
+    windows += result;
+    if (windows == 0)
+    {
+        atomic64_inc(&statistics.frames_identical);
+        trace_lcd_frame_dropped("identical");
+    }
+    else
+    {
+        shadow_valid = true;
+        atomic64_inc(&statistics.frames_committed);
+    }
+
+    complete_frames(sequence);
+    record_pixel_time(LCD_PRIORITY_NORMAL);
+    record_pixel_time(LCD_PRIORITY_HIGH);
+
+    return 0;
+}
+
+// Plans and sends the dirty columns, returns how many windows that took. A preemptible pass stops
+// at the next chunk boundary once a high priority commit waits, what it did not send yet still
+// differs from the shadow and goes out with the next pass.
+static int send_dirty_columns(bool preemptible)
+{
+    static struct flush_plan plan;
+    static struct flush_plan rows;
+    char set_memory_mode[] = {COMMAND, SET_MEMORY_MODE_COMMAND, MEMORY_MODE_SETTING};
+    u64 start_bytes = bytes_sent;
+    u64 start_transactions = transactions_sent;
+    size_t page;
+    size_t i;
+    int result = 0;
+
+    // Planned with the transfer size the pass is going to use
+    flush_preemptible = preemptible && preemptions_left > 0;
+    plan_flush(&plan, &rows);
+
+    for (page = 0; page < SCREEN_PAGES; page++)
+    {
+        bitmap_zero(dirty_columns[page], SCREEN_WIDTH);
+    }
+
+    if (plan.window_count == 0)
+    {
+        flush_preemptible = false;
+        return 0;
+    }
+
+    trace_lcd_flush_start(plan.window_count, plan.cost, plan.memory_mode,
+                          plan.windows[0].first_page, plan.windows[0].last_page,
+                          plan.windows[0].first_column, plan.windows[0].last_column);
+
+    if (!setting_cached(CACHED_MEMORY_MODE, plan.memory_mode))
+    {
+        set_memory_mode[2] = plan.memory_mode;
+        result = write_setting(CACHED_MEMORY_MODE, plan.memory_mode, set_memory_mode, sizeof(set_memory_mode));
+
+        __clear_bit(CACHED_PAGE_WINDOW, controller_cache_valid);
+        __clear_bit(CACHED_COLUMN_WINDOW, controller_cache_valid);
+    }
+
+    for (i = 0; i < plan.window_count && result == 0; i++)
+    {
+        result = flush_window(&plan.windows[i], plan.memory_mode);
+
+        if (result == 0)
+        {
+            update_shadow(&plan.windows[i]);
+        }
+    }
+    flush_preemptible = false;
+
+    // A window cut short leaves the write pointer somewhere inside it
+    if (result == -EAGAIN)
+    {
+        atomic64_inc(&statistics.flushes_preempted);
+        __clear_bit(CACHED_PAGE_WINDOW, controller_cache_valid);
+        __clear_bit(CACHED_COLUMN_WINDOW, controller_cache_valid);
+    }
+
+    trace_lcd_flush_end(bytes_sent - start_bytes, transactions_sent - start_transactions, result);
+
+    return result < 0 ? result : (int)plan.window_count;
+}
+
+static void record_pixel_time(u32 priority)
+{
+    if (flushing_since[priority] != 0)
+    {
+        record_latency(statistics.pixel_time[priority], flushing_since[priority]);
+        flushing_since[priority] = 0;
+    }
+}
+
+// A failed flush has dropped the shadow, so every retry resends the complete frame
+static int flush_screen(void)
+{
+    ktime_t start = ktime_get();
+    int result;
+    int retry = 0;
+
+    // A high priority file committing in a loop would otherwise keep normal content off the panel
+    preemptions_left = MAX_PREEMPTIONS;
+    result = try_flush_screen();
+
+    // A pass preempted by a high priority commit is no failure, the next pass sends the rest
+    while (result == -EAGAIN || (result < 0 && retry < FLUSH_RETRIES))
+    {
+        if (result == -EAGAIN)
+        {
+            preemptions_left--;
+        }
+        else
+        {
+            atomic64_inc(&statistics.i2c_retries);
+            retry++;
+        }
+
+        result = try_flush_screen();
+    }
+
+    record_latency(statistics.flush_time, start);
+
+    return result;
+}
+
+// Hands the drawing to the flush worker and returns its sequence number, writers return without
+// waiting for the bus. Frames committed before the worker gets to them go out as one. A high
+// priority commit claims everything drawn since the last compose, which is usually just the alert,
+// and preempts a flush in progress.
+static u64 commit_frame(u32 priority)
+{
+    u64 sequence = atomic64_inc_return(&committed_seq);
+    size_t page;
+
+    if (committed_since[priority] == 0)
+    {
+        committed_since[priority] = ktime_get();
+    }
+
+    if (priority == LCD_PRIORITY_HIGH)
+    {
+        for (page = 0; page < SCREEN_PAGES; page++)
+        {
+            bitmap_or(urgent_columns[page], urgent_columns[page], damaged_columns[page], SCREEN_WIDTH);
+        }
+
+        atomic_set(&urgent_pending, 1);
+    }
+
+    if (!panel_gone)
+    {
+        queue_work(system_highpri_wq, &commit_work);
+    }
+
+    return sequence;
+}
+
+static void flush_committed(struct work_struct *work)
+{
+    int result = lcd_power_get();
+
+    // Unpowered the frames stay committed and go out with the next flush
+    if (result == 0)
+    {
+        mutex_lock(&lcd_mutex);
+        result = flush_screen();
+        mutex_unlock(&lcd_mutex);
+
+        lcd_power_put();
+    }
+
+    WRITE_ONCE(flush_error, result);
+    if (result < 0)
+    {
+        wake_up_interruptible(&flush_wait);
+    }
+}
+
+// Everything committed up to sequence is on the panel
+static void complete_frames(u64 sequence)
+{
+    u64 flushed = atomic64_read(&flushed_seq);
+
+    if (sequence <= flushed)
+    {
+        return;
+    }
+
+    if (sequence - flushed > 1)
+    {
+        atomic64_add(sequence - flushed - 1, &statistics.frames_coalesced);
+        trace_lcd_frame_dropped("coalesced");
+    }
+
+    atomic64_set(&flushed_seq, sequence);
+    wake_up_interruptible(&flush_wait);
+
+    if (lcd_i2c_client != NULL)
+    {
+        sysfs_notify(&lcd_i2c_client->dev.kobj, NULL, flushed_seq_attribute.attr.name);
+    }
+}
+
+// Time NOP transactions of two lengths to express the per-transaction cost in bytes
+static void calibrate_flush_cost(void)
+{
+    char nop[] = {COMMAND, NOP_COMMAND};
+    char nop_burst[CALIBRATION_BURST_BYTES + 1];
+    ktime_t start;
+    u32 single_ns;
+    u32 burst_ns;
+    u32 byte_ns;
+    u32 overhead_ns;
+    size_t i;
+
+    memset(nop_burst, NOP_COMMAND, sizeof(nop_burst));
+    nop_burst[0] = COMMAND;
+
+    start = ktime_get();
+    for (i = 0; i < CALIBRATION_TRANSACTIONS; i++)
+    {
+        lcd_send(nop, sizeof(nop));
+    }
+    single_ns = (u32)ktime_to_ns(ktime_sub(ktime_get(), start)) / CALIBRATION_TRANSACTIONS;
+
+    start = ktime_get();
+    lcd_send(nop_burst, sizeof(nop_burst));
+    burst_ns = (u32)ktime_to_ns(ktime_sub(ktime_get(), start));
+
+    if (burst_ns <= single_ns)
+    {
+        return;
+    }
+
+    byte_ns = (burst_ns - single_ns) / (sizeof(nop_burst) - sizeof(nop));
+    overhead_ns = single_ns - (sizeof(nop) * byte_ns);
+
+    if (byte_ns == 0 || single_ns <= sizeof(nop) * byte_ns)
+    {
+        return;
+    }
+
+    transaction_overhead = clamp_t(size_t, DIV_ROUND_UP(overhead_ns, byte_ns), 1, MAX_TRANSACTION_OVERHEAD);
+
+    printk(KERN_INFO "eindopdracht transaction overhead %zu bytes (%u ns per byte)", transaction_overhead, byte_ns);
+}
+
+// Sends size bytes that follow buffer[0] in chunks of transfer_limit(), reusing the byte in front
+// of every chunk (already on the wire) for the DATA control byte
+static int send_data(char *buffer, size_t size)
+{
+    size_t chunk;
+
+    while (size > 0)
+    {
+        if (flush_preemptible && atomic_read(&urgent_pending) != 0)
+        {
+            return -EAGAIN;
+        }
+
+        chunk = min(size, transfer_limit() - 1);
+        buffer[0] = DATA;
+
+        if (lcd_send(buffer, chunk + 1) < 0)
+        {
+            return -EIO;
+        }
+
+        buffer += chunk;
+        size -= chunk;
+    }
+
+    return 0;
+}
+
+// Writes a known pattern into the GRAM pages below the visible rows using transfers of at most
+// transfer_size bytes, a transfer only verifies when the panel acknowledged every byte. The
+// pattern goes through the shadow, so the next flush knows to clear it again.
+static int self_test_transfer(size_t transfer_size, u32 *throughput)
+{
+    char set_window[] = {COMMAND,
+                         SET_MEMORY_MODE_COMMAND, HORIZONTAL_ADDRESSING,
+                         SET_PAGE_ADDRESS_COMMAND, (char)VISIBLE_PAGES, (char)(SCREEN_PAGES - 1),
+                         SET_COLUMN_START_ADDRESS, FIRST_COLUMN, LAST_COLUMN};
+    size_t saved_transfer = max_transfer;
+    char *pattern = shadow_gram + (VISIBLE_PAGES * SCREEN_WIDTH);
+    ktime_t start;
+    u32 elapsed_ns;
+    size_t i;
+    int result;
+
+    for (i = 0; i < SELF_TEST_BYTES; i++)
+    {
+        pattern[i] = (char)((i * 0x1D) ^ 0x5A);
+    }
+
+    result = lcd_send(set_window, sizeof(set_window));
+    if (result < 0)
+    {
+        return result;
+    }
+
+    cache_setting(CACHED_MEMORY_MODE, HORIZONTAL_ADDRESSING);
+    cache_setting(CACHED_PAGE_WINDOW, VISIBLE_PAGES | ((SCREEN_PAGES - 1) << 8));
+    cache_setting(CACHED_COLUMN_WINDOW, FIRST_COLUMN | (LAST_COLUMN << 8));
+    memcpy(_flush_buffer + 1, pattern, SELF_TEST_BYTES);
+
+    max_transfer = transfer_size;
+    start = ktime_get();
+    result = send_data(_flush_buffer, SELF_TEST_BYTES);
+    elapsed_ns = (u32)ktime_to_ns(ktime_sub(ktime_get(), start));
+    max_transfer = saved_transfer;
+
+    if (result < 0)
+    {
+        return result;
+    }
+
+    *throughput = (u32)div_u64((u64)SELF_TEST_BYTES * NSEC_PER_SEC, max_t(u32, elapsed_ns, 1));
+    return 0;
+}
+
+// The bus clock belongs to the adapter, so instead of stepping it the self-test steps the transfer
+// size at the configured clock and keeps the fastest size that verified. The configured clock is
+// the only rate it verifies, a faster one takes a new clock-frequency and another probe. When not
+// even the smallest transfer verifies the clock itself is wrong, which no transfer size makes up for.
+static int self_test_bus(void)
+{
+    size_t transfer_size;
+    size_t best_transfer = MIN_TRANSFER_SIZE;
+    u32 throughput = 0;
+    u32 best_throughput = 0;
+    int result;
+
+    if (bus_frequency > panel_bus_frequency)
+    {
+        printk(KERN_WARNING "eindopdracht bus runs at %u Hz, above the %u Hz the panel is rated for",
+               bus_frequency, panel_bus_frequency);
+    }
+
+    for (transfer_size = MIN_TRANSFER_SIZE; transfer_size <= SELF_TEST_BYTES + 1; transfer_size *= 2)
+    {
+        result = self_test_transfer(transfer_size, &throughput);
+        if (result < 0 && transfer_size == MIN_TRANSFER_SIZE && bus_frequency > DEFAULT_BUS_FREQUENCY)
+        {
+            printk(KERN_ERR "eindopdracht self-test failed at %u Hz, try the i2c2 clock-frequency at the %u Hz "
+                            "standard mode fallback (untested)",
+                   bus_frequency, DEFAULT_BUS_FREQUENCY);
+            return result;
+        }
+
+        if (result < 0 && transfer_size == MIN_TRANSFER_SIZE)
+        {
+            printk(KERN_ERR "eindopdracht self-test failed at %u Hz, check the wiring and i2c-address", bus_frequency);
+            return result;
+        }
+
+        if (result < 0)
+        {
+            printk(KERN_WARNING "eindopdracht self-test failed at %zu byte transfers, falling back", transfer_size);
+            break;
+        }
+
+        if (throughput > best_throughput)
+        {
+            best_throughput = throughput;
+            best_transfer = transfer_size;
+        }
+    }
+
+    max_transfer = best_transfer;
+    measured_throughput = best_throughput;
+
+    printk(KERN_INFO "eindopdracht self-test verified %u Hz, %u bytes/s with %zu byte transfers (%u bytes/s theoretical)",
+           bus_frequency, measured_throughput, max_transfer, bus_frequency / I2C_BITS_PER_BYTE);
+
+    if (bus_frequency < panel_bus_frequency)
+    {
+        printk(KERN_INFO "eindopdracht panel is rated for %u Hz, raise the i2c2 clock-frequency and reload to verify it",
+               panel_bus_frequency);
+    }
+
+    return 0;
+}
+#pragma endregion
+
+#pragma region driver_init
+#ifndef LCD_DRIVER_KUNIT
+static int lcd_driver_init(void)
+{
+    u32 buffer = DEFAULT_I2C_ADDRESS;
+
+    printk(KERN_ALERT "eindopracht init");
+
+    struct i2c_adapter *lcd_i2c_adapter = i2c_get_adapter(adapter_number);
+
+    if (lcd_i2c_adapter == NULL)
+    {
+        printk(KERN_ERR "eindopdracht no i2c-%d adapter", adapter_number);
+        return -ENODEV;
+    }
+
+    // Without a device tree node (e.g. the ssd1306_virtual adapter) the defaults stay in place
+    struct device_node *i2c2_node = lcd_i2c_adapter->dev.of_node;
+    struct device_node *lcd_node = of_find_node_by_name(i2c2_node, "lcd_driver");
+
+    of_property_read_u32(lcd_node, "i2c-address", &buffer);
+    of_property_read_u32(i2c2_node, "clock-frequency", &bus_frequency);
+    of_property_read_u32(lcd_node, "bus-frequency", &panel_bus_frequency);
+    of_property_read_u32(lcd_node, "autosuspend-delay-ms", &autosuspend_delay);
+
+    struct i2c_board_info lcd_i2c_board_info = {
+        .type = "lcd-driver",
+        .addr = buffer,
+    };
+
+    debugfs_driver_root = debugfs_create_dir(i2c_driver.driver.name, NULL);
+
+    i2c_new_client_device(lcd_i2c_adapter, &lcd_i2c_board_info);
+    i2c_put_adapter(lcd_i2c_adapter);
+    i2c_add_driver(&i2c_driver);
+
+    return 0;
+}
+
+static void lcd_driver_exit(void)
+{
+    printk(KERN_ALERT "eindopdracht exit");
+
+    i2c_del_driver(&i2c_driver);
+    i2c_unregister_device(lcd_i2c_client);
+
+    debugfs_remove_recursive(debugfs_driver_root);
+}
+#endif
+#pragma endregion
+
+#pragma region platform_driver_init
+static int lcd_driver_probe(struct i2c_client *client, const struct i2c_device_id *id)
+{
+    int result;
+
+    lcd_i2c_client = client;
+    panel_gone = false;
+
+    pm_runtime_get_noresume(&client->dev);
+    pm_runtime_set_active(&client->dev);
+    pm_runtime_set_autosuspend_delay(&client->dev, autosuspend_delay);
+    pm_runtime_use_autosuspend(&client->dev);
+    pm_runtime_enable(&client->dev);
+
+    hrtimer_init(&present_timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+    present_timer.function = presentation_due;
+    init_layer(&text_overlay);
+
+    mutex_lock(&frame_mutex);
+    place_layer(&text_overlay);
+    mutex_unlock(&frame_mutex);
+
+    mutex_lock(&lcd_mutex);
+    initialize_screen();
+    result = self_test_bus();
+    if (result < 0)
+    {
+        mutex_unlock(&lcd_mutex);
+
+        mutex_lock(&frame_mutex);
+        list_del_init(&text_overlay.node);
+        mutex_unlock(&frame_mutex);
+
+        pm_runtime_disable(&client->dev);
+        pm_runtime_dont_use_autosuspend(&client->dev);
+        pm_runtime_put_noidle(&client->dev);
+        pm_runtime_set_suspended(&client->dev);
+        return result;
+    }
+    calibrate_flush_cost();
+    flush_screen(); // clears the self-test pattern from the hidden pages
+    mutex_unlock(&lcd_mutex);
+
+    lcd_power_put();
+
+    printk(KERN_ALERT "eindopdracht inserting attributes");
+    driver_create_file(&(i2c_driver.driver), &display_attribute);
+    driver_create_file(&(i2c_driver.driver), &display_at_attribute);
+    driver_create_file(&(i2c_driver.driver), &overlay_attribute);
+    driver_create_file(&(i2c_driver.driver), &region_attribute);
+    driver_create_file(&(i2c_driver.driver), &region_text_attribute);
+    driver_create_file(&(i2c_driver.driver), &draw_attribute);
+    driver_create_file(&(i2c_driver.driver), &enable_attribute);
+    driver_create_file(&(i2c_driver.driver), &contrast_attribute);
+    driver_create_file(&(i2c_driver.driver), &bus_frequency_attribute);
+    driver_create_file(&(i2c_driver.driver), &throughput_attribute);
+    driver_create_file(&(i2c_driver.driver), &max_transfer_attribute);
+    driver_create_file(&(i2c_driver.driver), &resume_latency_attribute);
+
+    create_debugfs();
+    device_create_bin_file(&client->dev, &frame_attribute);
+    device_create_file(&client->dev, &committed_seq_attribute);
+    device_create_file(&client->dev, &flushed_seq_attribute);
+    result = misc_register(&layer_device);
+    layer_device_registered = result == 0;
+    if (result < 0)
+    {
+        printk(KERN_WARNING "eindopdracht no /dev/lcd (%d), only the sysfs interfaces", result);
+    }
+
+    driver_create_file(&(i2c_driver.driver), &bus_load_attribute);
+    driver_create_file(&(i2c_driver.driver), &bus_rate_attribute);
+    driver_create_file(&(i2c_driver.driver), &bus_capacity_attribute);
+    driver_create_file(&(i2c_driver.driver), &max_fps_attribute);
+
+    sampled_at = ktime_get();
+    schedule_delayed_work(&bus_load_work, LOAD_FREQ);
+
+    // The console keeps the panel powered, so a hang after a quiet stretch still shows the last lines
+    if (enable_console)
+    {
+        pm_runtime_forbid(&client->dev);
+        register_console(&lcd_console);
+    }
+
+    return 0;
+}
+
+static int lcd_driver_remove(struct i2c_client *client)
+{
+    if (enable_console)
+    {
+        unregister_console(&lcd_console);
+        cancel_delayed_work_sync(&console_work);
+        pm_runtime_allow(&client->dev);
+    }
+
+    printk(KERN_ALERT "eindopracht removing attributes");
+    driver_remove_file(&(i2c_driver.driver), &display_attribute);
+    driver_remove_file(&(i2c_driver.driver), &display_at_attribute);
+    driver_remove_file(&(i2c_driver.driver), &overlay_attribute);
+    driver_remove_file(&(i2c_driver.driver), &region_attribute);
+    driver_remove_file(&(i2c_driver.driver), &region_text_attribute);
+    driver_remove_file(&(i2c_driver.driver), &draw_attribute);
+    driver_remove_file(&(i2c_driver.driver), &enable_attribute);
+    driver_remove_file(&(i2c_driver.driver), &contrast_attribute);
+    driver_remove_file(&(i2c_driver.driver), &bus_frequency_attribute);
+    driver_remove_file(&(i2c_driver.driver), &throughput_attribute);
+    driver_remove_file(&(i2c_driver.driver), &max_transfer_attribute);
+    driver_remove_file(&(i2c_driver.driver), &resume_latency_attribute);
+
+    debugfs_remove_recursive(debugfs_root);
+    debugfs_root = NULL;
+    device_remove_bin_file(&client->dev, &frame_attribute);
+    if (layer_device_registered)
+    {
+        misc_deregister(&layer_device);
+        layer_device_registered = false;
+    }
+
+    device_remove_file(&client->dev, &committed_seq_attribute);
+    device_remove_file(&client->dev, &flushed_seq_attribute);
+
+    hrtimer_cancel(&text_overlay.expiry);
+    cancel_work_sync(&text_overlay.restore_work);
+    // Without queued frames a running present_frames() has nothing to re-arm the timer for. Files
+    // still open keep their layers, but no longer commit to the panel that went away.
+    mutex_lock(&frame_mutex);
+    panel_gone = true;
+    drop_queued_frames(NULL);
+    mutex_unlock(&frame_mutex);
+    cancel_work_sync(&present_work);
+    hrtimer_cancel(&present_timer);
+    cancel_work_sync(&present_work); // queued by a timer that fired before it was cancelled
+    flush_work(&commit_work);
+
+    mutex_lock(&lcd_mutex);
+    stop_recording();
+    vfree(recording);
+    recording = NULL;
+    mutex_unlock(&lcd_mutex);
+
+    mutex_lock(&frame_mutex);
+    capturing = false;
+    vfree(capture_log);
+    capture_log = NULL;
+    list_del_init(&text_overlay.node);
+    text_overlay.visible = false;
+    count_overlay_urgency();
+    mutex_unlock(&frame_mutex);
+
+    cancel_delayed_work_sync(&bus_load_work);
+    driver_remove_file(&(i2c_driver.driver), &bus_load_attribute);
+    driver_remove_file(&(i2c_driver.driver), &bus_rate_attribute);
+    driver_remove_file(&(i2c_driver.driver), &bus_capacity_attribute);
+    driver_remove_file(&(i2c_driver.driver), &max_fps_attribute);
+
+    pm_runtime_disable(&client->dev);
+    pm_runtime_dont_use_autosuspend(&client->dev);
+    pm_runtime_set_suspended(&client->dev);
+    return 0;
+}
+#pragma endregion
+
+#pragma region runtime_pm
+static int lcd_power_get(void)
+{
+    int result = pm_runtime_get_sync(&lcd_i2c_client->dev);
+
+    if (result < 0)
+    {
+        pm_runtime_put_noidle(&lcd_i2c_client->dev);
+        return result;
+    }
+
+    return 0;
+}
+
+static void lcd_power_put(void)
+{
+    pm_runtime_mark_last_busy(&lcd_i2c_client->dev);
+    pm_runtime_put_autosuspend(&lcd_i2c_client->dev);
+}
+
+static int power_down_panel(void)
+{
+    char power_down[] = {COMMAND, ENABLE_SCREEN_COMMAND, PUMP_COMMAND, PUMP_OFF_SETTING};
+    int result = 0;
+
+    if (!setting_cached(CACHED_DISPLAY, 0) || !setting_cached(CACHED_CHARGE_PUMP, PUMP_OFF_SETTING))
+    {
+        result = lcd_send(power_down, sizeof(power_down));
+    }
+
+    if (result == 0)
+    {
+        cache_setting(CACHED_DISPLAY, 0);
+        cache_setting(CACHED_CHARGE_PUMP, PUMP_OFF_SETTING);
+    }
+
+    return result;
+}
+
+static int lcd_runtime_suspend(struct device *device)
+{
+    int result;
+
+    mutex_lock(&lcd_mutex);
+    result = power_down_panel();
+    mutex_unlock(&lcd_mutex);
+
+    trace_lcd_pm_transition("runtime_suspend", result);
+    return result;
+}
+
+// GRAM survives with the charge pump off, so waking up only needs the pump and the display back
+static int lcd_runtime_resume(struct device *device)
+{
+    char wake_up[] = {COMMAND, PUMP_COMMAND, PUMP_SETTING, ENABLE_SCREEN_COMMAND};
+    int result = 0;
+
+    wake_up[3] |= lcd_display_state;
+
+    mutex_lock(&lcd_mutex);
+    if (!setting_cached(CACHED_CHARGE_PUMP, PUMP_SETTING) || !setting_cached(CACHED_DISPLAY, lcd_display_state))
+    {
+        result = lcd_send(wake_up, sizeof(wake_up));
+    }
+
+    if (result == 0)
+    {
+        cache_setting(CACHED_CHARGE_PUMP, PUMP_SETTING);
+        cache_setting(CACHED_DISPLAY, lcd_display_state);
+    }
+    mutex_unlock(&lcd_mutex);
+
+    trace_lcd_pm_transition("runtime_resume", result);
+    return result;
+}
+#pragma endregion
+
+#pragma region system_pm
+static int lcd_suspend(struct device *device)
+{
+    int result;
+
+    if (pm_runtime_status_suspended(device))
+    {
+        return 0;
+    }
+
+    mutex_lock(&lcd_mutex);
+    result = power_down_panel();
+    mutex_unlock(&lcd_mutex);
+
+    trace_lcd_pm_transition("suspend", result);
+    return result;
+}
+
+// The panel may have lost power, so replay the whole init stream and the last committed frame. A
+// panel that was runtime suspended stays dark throughout, only its registers and GRAM come back.
+static int lcd_resume(struct device *device)
+{
+    bool suspended = pm_runtime_status_suspended(device);
+    ktime_t start = ktime_get();
+    int result;
+
+    mutex_lock(&lcd_mutex);
+    result = send_init_sequence(suspended ? 0 : lcd_display_state);
+
+    if (result == 0)
+    {
+        write_buffer_to_screen();
+    }
+
+    if (result == 0 && suspended)
+    {
+        result = power_down_panel();
+    }
+    mutex_unlock(&lcd_mutex);
+
+    resume_latency = (u32)ktime_us_delta(ktime_get(), start);
+    printk(KERN_INFO "eindopdracht resumed in %u us", resume_latency);
+    trace_lcd_pm_transition("resume", result);
+
+    return result;
+}
+#pragma endregion
+
+#pragma region enable_lcd
+static ssize_t show_enable_lcd(struct device_driver *device, char *buffer)
+{
+    return sprintf(buffer, "%u\n", lcd_display_state);
+}
+
+static ssize_t store_enable_lcd(struct device_driver *device, const char *buffer, size_t size)
+{
+    char send_buffer[2] = {COMMAND, ENABLE_SCREEN_COMMAND};
+    int result = -1;
+
+    if (buffer[0] == '0')
+    {
+        lcd_display_state = 0;
+    }
+    else if (buffer[0] == '1')
+    {
+        lcd_display_state = 1;
+    }
+    else
+    {
+        return -1;
+    }
+
+    send_buffer[1] |= lcd_display_state;
+
+    result = lcd_power_get();
+    if (result < 0)
+    {
+        return result;
+    }
+
+    mutex_lock(&frame_mutex);
+    capture_request(CAPTURE_ENABLE, 0, buffer, size);
+    mutex_unlock(&frame_mutex);
+
+    mutex_lock(&lcd_mutex);
+    result = write_setting(CACHED_DISPLAY, lcd_display_state, send_buffer, sizeof(send_buffer));
+    mutex_unlock(&lcd_mutex);
+
+    lcd_power_put();
+
+    if (result < 0)
+    {
+        return result;
+    }
+
+    return size;
+}
+#pragma endregion
+
+#pragma region contrast_lcd
+static ssize_t show_contrast_lcd(struct device_driver *device, char *buffer)
+{
+    return sprintf(buffer, "%u\n", lcd_contrast);
+}
+
+static ssize_t store_contrast_lcd(struct device_driver *device, const char *buffer, size_t size)
+{
+    char send_buffer[3] = {COMMAND, SET_CONTRAST_COMMAND, CONTRAST_SETTING};
+    unsigned int contrast;
+    int result;
+
+    if (kstrtouint(buffer, 0, &contrast) < 0 || contrast > 0xFF)
+    {
+        return -EINVAL;
+    }
+
+    send_buffer[2] = (char)contrast;
+
+    result = lcd_power_get();
+    if (result < 0)
+    {
+        return result;
+    }
+
+    mutex_lock(&frame_mutex);
+    capture_request(CAPTURE_CONTRAST, 0, buffer, size);
+    mutex_unlock(&frame_mutex);
+
+    mutex_lock(&lcd_mutex);
+    result = write_setting(CACHED_CONTRAST, contrast, send_buffer, sizeof(send_buffer));
+    if (result == 0)
+    {
+        lcd_contrast = (unsigned char)contrast;
+    }
+    mutex_unlock(&lcd_mutex);
+
+    lcd_power_put();
+
+    if (result < 0)
+    {
+        return result;
+    }
+
+    return size;
+}
+#pragma endregion
+
+#pragma region lcd_display
+
+static ssize_t store_display_lcd(struct device_driver *device, const char *buffer, size_t size)
+{
+    size_t glyphs;
+    struct flush_window damage;
+    ktime_t start = ktime_get();
+
+    if (enable_console)
+    {
+        return -EBUSY;
+    }
+
+    trace_lcd_display_write("display", size, task_pid_nr(current));
+    atomic64_inc(&statistics.writes);
+
+    mutex_lock(&frame_mutex);
+    capture_request(CAPTURE_DISPLAY, 0, buffer, size);
+    record_latency(statistics.queue_time, start);
+    start = ktime_get();
+    reset_screen();
+    glyphs = render_text(buffer, size);
+
+    record_latency(statistics.render_time, start);
+
+    if (trace_lcd_render_done_enabled() && damage_bounds(&damage))
+    {
+        trace_lcd_render_done(glyphs, damage.first_page, damage.last_page, damage.first_column, damage.last_column);
+    }
+
+    commit_frame(LCD_PRIORITY_NORMAL);
+    mutex_unlock(&frame_mutex);
+
+    return size;
+}
+
+// Renders text into the back buffer from the cursor on and returns the number of glyphs drawn
+static size_t render_text(const char *buffer, size_t size)
+{
+    int i;
+    char current_char;
+    size_t character_offset;
+    size_t glyphs = 0;
+
+    for (i = 0; i < size; i++)
+    {
+        current_char = buffer[i];
+
+        if (current_char == '\n' || x >= (SCREEN_WIDTH - CHARACTER_SPACE))
+        {
+            x = 0;
+            y += 1;
+        }
+
+        if (y >= SCREEN_PAGES)
+        {
+            break;
+        }
+
+        if (current_char >= ' ' && current_char <= '~' && !(x == 0 && current_char == ' '))
+        {
+            character_offset = (current_char - ' ') * CHARACTER_BYTES;
+            memcpy(base_layer + (x + (SCREEN_WIDTH * y)), characters + character_offset, CHARACTER_BYTES);
+            mark_damage(y, x, x + CHARACTER_BYTES - 1);
+            x += CHARACTER_SPACE;
+            glyphs++;
+        }
+    }
+
+    return glyphs;
+}
+
+// "row column max_width text" with row a page and column and max_width in characters. Only the
+// field is cleared and redrawn, the rest of the screen keeps what earlier writes put there.
+static ssize_t store_display_at_lcd(struct device_driver *device, const char *buffer, size_t size)
+{
+    unsigned int row;
+    unsigned int column;
+    unsigned int max_width;
+    int consumed = 0;
+    const char *text;
+    size_t length;
+    size_t first_column;
+    size_t width;
+    size_t glyphs;
+    ktime_t start = ktime_get();
+
+    if (enable_console)
+    {
+        return -EBUSY;
+    }
+
+    if (sscanf(buffer, "%u %u %u%n", &row, &column, &max_width, &consumed) != 3 || row >= SCREEN_PAGES ||
+        column * CHARACTER_SPACE >= SCREEN_WIDTH)
+    {
+        return -EINVAL;
+    }
+
+    // Exactly one separator, so leading spaces in the text still pad the field
+    text = buffer + consumed;
+    length = size - consumed;
+    if (length > 0 && *text == ' ')
+    {
+        text++;
+        length--;
+    }
+
+    if (length > 0 && text[length - 1] == '\n')
+    {
+        length--;
+    }
+
+    first_column = column * CHARACTER_SPACE;
+    width = min_t(size_t, (size_t)max_width * CHARACTER_SPACE, SCREEN_WIDTH - first_column);
+
+    trace_lcd_display_write("display_at", size, task_pid_nr(current));
+    atomic64_inc(&statistics.writes);
+
+    mutex_lock(&frame_mutex);
+    capture_request(CAPTURE_DISPLAY_AT, 0, buffer, size);
+    record_latency(statistics.queue_time, start);
+    start = ktime_get();
+    glyphs = render_field(base_layer, row, first_column, width, text, length);
+    record_latency(statistics.render_time, start);
+
+    if (trace_lcd_render_done_enabled() && width > 0)
+    {
+        trace_lcd_render_done(glyphs, row, row, first_column, first_column + width - 1);
+    }
+
+    commit_frame(LCD_PRIORITY_NORMAL);
+    mutex_unlock(&frame_mutex);
+
+    return size;
+}
+
+// Clears width columns of page from first_column on and draws the text into them without wrapping,
+// a glyph that does not fit completely is left out
+static size_t render_field(char *target, size_t page, size_t first_column, size_t width, const char *text,
+                           size_t length)
+{
+    char *field = target + first_column + (SCREEN_WIDTH * page);
+    size_t column = 0;
+    size_t glyphs = 0;
+    size_t i;
+
+    if (width == 0)
+    {
+        return 0;
+    }
+
+    memset(field, 0x00, width);
+
+    for (i = 0; i < length && column + CHARACTER_BYTES <= width; i++)
+    {
+        if (text[i] >= ' ' && text[i] <= '~')
+        {
+            memcpy(field + column, characters + ((text[i] - ' ') * CHARACTER_BYTES), CHARACTER_BYTES);
+            glyphs++;
+        }
+
+        column += CHARACTER_SPACE;
+    }
+
+    mark_damage(page, first_column, first_column + width - 1);
+    return glyphs;
+}
+
+// "milliseconds text" shows the text as a banner over everything else and restores what was under
+// it when the time is up, 0 keeps it until the next write. Empty text takes the banner down.
+static ssize_t store_overlay_lcd(struct device_driver *device, const char *buffer, size_t size)
+{
+    unsigned int milliseconds;
+    int consumed = 0;
+    const char *text;
+    size_t length;
+    ktime_t start = ktime_get();
+
+    if (enable_console)
+    {
+        return -EBUSY;
+    }
+
+    if (sscanf(buffer, "%u%n", &milliseconds, &consumed) != 1)
+    {
+        return -EINVAL;
+    }
+
+    text = buffer + consumed;
+    length = size - consumed;
+    if (length > 0 && *text == ' ')
+    {
+        text++;
+        length--;
+    }
+
+    if (length > 0 && text[length - 1] == '\n')
+    {
+        length--;
+    }
+
+    trace_lcd_display_write("overlay", size, task_pid_nr(current));
+    atomic64_inc(&statistics.writes);
+
+    mutex_lock(&frame_mutex);
+    capture_request(CAPTURE_OVERLAY, 0, buffer, size);
+    record_latency(statistics.queue_time, start);
+
+    if (text_overlay.visible)
+    {
+        damage_layer(&text_overlay);
+    }
+
+    start = ktime_get();
+    render_overlay(text, length);
+    record_latency(statistics.render_time, start);
+
+    if (length > 0)
+    {
+        show_layer_for(&text_overlay, milliseconds);
+    }
+    else
+    {
+        text_overlay.visible = false;
+        text_overlay.expires = 0;
+    }
+
+    count_overlay_urgency();
+    commit_frame(LCD_PRIORITY_HIGH);
+    mutex_unlock(&frame_mutex);
+
+    return size;
+}
+
+// One centred line per page, the block centred on the visible pages and masked as full width bands
+static void render_overlay(const char *text, size_t length)
+{
+    const char *line = text;
+    const char *end = text + length;
+    const char *newline;
+    size_t lines = 1;
+    size_t page;
+    size_t glyphs;
+    size_t first_column;
+    size_t i;
+
+    for (i = 0; i < length; i++)
+    {
+        lines += text[i] == '\n';
+    }
+
+    memset(text_overlay.pixels, 0x00, sizeof(text_overlay.pixels));
+    memset(text_overlay.mask, 0x00, sizeof(text_overlay.mask));
+
+    if (length == 0)
+    {
+        return;
+    }
+
+    page = lines < VISIBLE_PAGES ? (VISIBLE_PAGES - lines) / 2 : 0;
+
+    for (i = 0; i < lines && page < VISIBLE_PAGES; i++, page++)
+    {
+        newline = memchr(line, '\n', end - line);
+        if (newline == NULL)
+        {
+            newline = end;
+        }
+
+        glyphs = min_t(size_t, newline - line, SCREEN_WIDTH / CHARACTER_SPACE);
+        first_column = glyphs > 0 ? (SCREEN_WIDTH - (glyphs * CHARACTER_SPACE - 1)) / 2 : 0;
+
+        render_field(text_overlay.pixels, page, first_column, SCREEN_WIDTH - first_column, line, newline - line);
+        memset(text_overlay.mask + (SCREEN_WIDTH * page), 0xFF, SCREEN_WIDTH);
+
+        line = newline < end ? newline + 1 : end;
+    }
+}
+
+// The overlay commits at high priority, so while it is shown it counts as a high priority layer
+static void count_overlay_urgency(void)
+{
+    if (text_overlay.visible != overlay_urgent)
+    {
+        atomic_add(text_overlay.visible ? 1 : -1, &urgent_layers);
+        overlay_urgent = text_overlay.visible;
+    }
+}
+
+#pragma endregion
+
+#pragma region region_lcd
+static ssize_t show_region_lcd(struct device_driver *device, char *buffer)
+{
+    ssize_t size = 0;
+    size_t i;
+
+    mutex_lock(&frame_mutex);
+    for (i = 0; i < MAX_REGIONS; i++)
+    {
+        if (regions[i].used)
+        {
+            size += scnprintf(buffer + size, PAGE_SIZE - size, "%s %zu %zu %zu %zu %u cursor %zu,%zu\n",
+                              regions[i].name, regions[i].first_page, regions[i].last_page,
+                              regions[i].first_column, regions[i].last_column, regions[i].scale, regions[i].x,
+                              regions[i].y);
+        }
+    }
+    mutex_unlock(&frame_mutex);
+
+    return size;
+}
+
+// "name first_page last_page first_column last_column [scale]" defines or moves a region and clears
+// it, "-name" deletes one and leaves its pixels where they are
+static ssize_t store_region_lcd(struct device_driver *device, const char *buffer, size_t size)
+{
+    char name[REGION_NAME_BYTES];
+    unsigned int first_page;
+    unsigned int last_page;
+    unsigned int first_column;
+    unsigned int last_column;
+    unsigned int scale = 1;
+    struct lcd_region *region;
+    int fields;
+    int result;
+
+    if (enable_console)
+    {
+        return -EBUSY;
+    }
+
+    fields = sscanf(buffer, "%15s %u %u %u %u %u", name, &first_page, &last_page, &first_column, &last_column,
+                    &scale);
+
+    if (fields == 1 && name[0] == '-')
+    {
+        mutex_lock(&frame_mutex);
+        capture_request(CAPTURE_REGION, 0, buffer, size);
+        region = find_region(name + 1);
+        if (region != NULL)
+        {
+            region->used = false;
+        }
+        mutex_unlock(&frame_mutex);
+
+        return region != NULL ? size : -ENOENT;
+    }
+
+    if (fields < 5 || name[0] == '-' || first_page > last_page || last_page >= SCREEN_PAGES ||
+        first_column > last_column || last_column >= SCREEN_WIDTH || scale < 1 || scale > MAX_FONT_SCALE)
+    {
+        return -EINVAL;
+    }
+
+    trace_lcd_display_write("region", size, task_pid_nr(current));
+    atomic64_inc(&statistics.writes);
+
+    mutex_lock(&frame_mutex);
+    capture_request(CAPTURE_REGION, 0, buffer, size);
+
+    region = find_region(name);
+    if (region == NULL)
+    {
+        region = find_region("");
+    }
+
+    if (region == NULL)
+    {
+        result = -ENOSPC;
+    }
+    else
+    {
+        region->used = true;
+        strscpy(region->name, name, sizeof(region->name));
+        region->first_page = first_page;
+        region->last_page = last_page;
+        region->first_column = first_column;
+        region->last_column = last_column;
+        region->scale = scale;
+        clear_region(region);
+        commit_frame(LCD_PRIORITY_NORMAL);
+        result = 0;
+    }
+    mutex_unlock(&frame_mutex);
+
+    if (result < 0)
+    {
+        return result;
+    }
+
+    return size;
+}
+
+// "name text" writes text at the region's cursor like a small terminal: newlines and wrapping move
+// down a line, '\f' clears the region, text past the bottom is clipped
+static ssize_t store_region_text_lcd(struct device_driver *device, const char *buffer, size_t size)
+{
+    char name[REGION_NAME_BYTES];
+    const char *text = memchr(buffer, ' ', size);
+    struct lcd_region *region;
+    size_t length;
+    size_t glyphs = 0;
+    ktime_t start = ktime_get();
+
+    if (enable_console)
+    {
+        return -EBUSY;
+    }
+
+    if (text == NULL || text - buffer >= REGION_NAME_BYTES || text == buffer)
+    {
+        return -EINVAL;
+    }
+
+    memcpy(name, buffer, text - buffer);
+    name[text - buffer] = '\0';
+    text++;
+    length = size - (text - buffer);
+
+    // echo ends the text with a newline, which would move the cursor off a one page region
+    if (length > 0 && text[length - 1] == '\n')
+    {
+        length--;
+    }
+
+    trace_lcd_display_write("region_text", size, task_pid_nr(current));
+    atomic64_inc(&statistics.writes);
+
+    mutex_lock(&frame_mutex);
+    capture_request(CAPTURE_REGION_TEXT, 0, buffer, size);
+    record_latency(statistics.queue_time, start);
+
+    region = find_region(name);
+    if (region != NULL)
+    {
+        start = ktime_get();
+        glyphs = render_region(region, text, length);
+        record_latency(statistics.render_time, start);
+
+        if (trace_lcd_render_done_enabled())
+        {
+            trace_lcd_render_done(glyphs, region->first_page, region->last_page, region->first_column,
+                                  region->last_column);
+        }
+
+        commit_frame(LCD_PRIORITY_NORMAL);
+    }
+    mutex_unlock(&frame_mutex);
+
+    return region != NULL ? size : -ENOENT;
+}
+
+// An empty name finds a free slot
+static struct lcd_region *find_region(const char *name)
+{
+    size_t i;
+
+    for (i = 0; i < MAX_REGIONS; i++)
+    {
+        if (name[0] == '\0' ? !regions[i].used : regions[i].used && strcmp(regions[i].name, name) == 0)
+        {
+            return &regions[i];
+        }
+    }
+
+    return NULL;
+}
+
+static void clear_region(struct lcd_region *region)
+{
+    size_t columns = region->last_column - region->first_column + 1;
+    size_t page;
+
+    for (page = region->first_page; page <= region->last_page; page++)
+    {
+        memset(base_layer + region->first_column + (SCREEN_WIDTH * page), 0x00, columns);
+        mark_damage(page, region->first_column, region->last_column);
+    }
+
+    region->x = 0;
+    region->y = 0;
+}
+
+// Draws a whole character cell at the cursor, scaled up by pixel doubling and clipped to the region
+static void draw_glyph(char *target, const struct lcd_region *region, char character)
+{
+    const char *glyph = characters + ((character - ' ') * CHARACTER_BYTES);
+    size_t first_row = region->first_page * CHARACTER_HEIGHT;
+    size_t last_row = ((region->last_page + 1) * CHARACTER_HEIGHT) - 1;
+    size_t column;
+    size_t row;
+    size_t pixel_column;
+    size_t pixel_row;
+    char *byte;
+    bool set;
+
+    for (column = 0; column < CHARACTER_SPACE * region->scale; column++)
+    {
+        pixel_column = region->first_column + region->x + column;
+        if (pixel_column > region->last_column)
+        {
+            break;
+        }
+
+        for (row = 0; row < CHARACTER_HEIGHT * region->scale; row++)
+        {
+            pixel_row = first_row + region->y + row;
+            if (pixel_row > last_row)
+            {
+                break;
+            }
+
+            set = column < CHARACTER_BYTES * region->scale &&
+                  (glyph[column / region->scale] >> (row / region->scale)) & 1;
+            byte = target + pixel_column + (SCREEN_WIDTH * (pixel_row / CHARACTER_HEIGHT));
+
+            if (set)
+            {
+                *byte |= (char)(1 << (pixel_row % CHARACTER_HEIGHT));
+            }
+            else
+            {
+                *byte &= (char)~(1 << (pixel_row % CHARACTER_HEIGHT));
+            }
+        }
+    }
+}
+
+static size_t render_region(struct lcd_region *region, const char *text, size_t length)
+{
+    size_t width = region->last_column - region->first_column + 1;
+    size_t height = (region->last_page - region->first_page + 1) * CHARACTER_HEIGHT;
+    size_t advance = CHARACTER_SPACE * region->scale;
+    size_t line_height = CHARACTER_HEIGHT * region->scale;
+    size_t glyphs = 0;
+    size_t i;
+
+    for (i = 0; i < length; i++)
+    {
+        if (text[i] == '\f')
+        {
+            clear_region(region);
+            continue;
+        }
+
+        if (text[i] == '\n' || (region->x > 0 && region->x + CHARACTER_BYTES * region->scale > width))
+        {
+            region->x = 0;
+            region->y += line_height;
+        }
+
+        if (text[i] < ' ' || text[i] > '~' || region->y >= height)
+        {
+            continue;
+        }
+
+        draw_glyph(base_layer, region, text[i]);
+        region->x += advance;
+        glyphs++;
+    }
+
+    // Only the region can have changed, the shadow diff narrows it down to the touched columns
+    for (i = region->first_page; i <= region->last_page; i++)
+    {
+        mark_damage(i, region->first_column, region->last_column);
+    }
+
+    return glyphs;
+}
+#pragma endregion
+
+#pragma region draw_lcd
+static ssize_t store_draw_lcd(struct device_driver *device, const char *buffer, size_t size)
+{
+    ktime_t start = ktime_get();
+    int result;
+
+    if (enable_console)
+    {
+        return -EBUSY;
+    }
+
+    trace_lcd_display_write("draw", size, task_pid_nr(current));
+    atomic64_inc(&statistics.writes);
+
+    mutex_lock(&frame_mutex);
+    capture_request(CAPTURE_DRAW, 0, buffer, size);
+    record_latency(statistics.queue_time, start);
+    start = ktime_get();
+
+    result = run_draw(base_layer, (const u8 *)buffer, size);
+    record_latency(statistics.render_time, start);
+
+    if (result > 0)
+    {
+        commit_frame(LCD_PRIORITY_NORMAL);
+    }
+    mutex_unlock(&frame_mutex);
+
+    return result < 0 ? result : size;
+}
+
+static long draw_layer(struct lcd_layer *layer, const struct lcd_draw_buffer __user *user_draw)
+{
+    struct lcd_draw_buffer draw;
+    u8 *commands;
+    int result;
+
+    if (copy_from_user(&draw, user_draw, sizeof(draw)) != 0)
+    {
+        return -EFAULT;
+    }
+
+    if (draw.size > LCD_DRAW_MAX_BYTES)
+    {
+        return -E2BIG;
+    }
+
+    commands = memdup_user(u64_to_user_ptr(draw.commands), draw.size);
+    if (IS_ERR(commands))
+    {
+        return PTR_ERR(commands);
+    }
+
+    trace_lcd_display_write("layer_draw", draw.size, task_pid_nr(current));
+    atomic64_inc(&statistics.writes);
+
+    mutex_lock(&frame_mutex);
+    result = run_draw(layer->pixels, commands, draw.size);
+
+    if (result > 0 && layer->visible)
+    {
+        atomic64_set(&layer->sequence, commit_frame(layer->priority));
+    }
+    mutex_unlock(&frame_mutex);
+
+    kfree(commands);
+    return result < 0 ? result : 0;
+}
+
+// Checks the whole buffer, then draws it. Returns 1 when it asked for a commit.
+static int run_draw(char *target, const u8 *commands, size_t size)
+{
+    size_t offset;
+    size_t length;
+    bool commit = false;
+
+    if (size == 0 || commands[0] != LCD_DRAW_VERSION)
+    {
+        return -EINVAL;
+    }
+
+    for (offset = 1; offset < size; offset += length)
+    {
+        length = draw_command_size(commands + offset, size - offset);
+        if (length == 0)
+        {
+            return -EINVAL;
+        }
+    }
+
+    for (offset = 1; offset < size; offset += length)
+    {
+        length = draw_command_size(commands + offset, size - offset);
+        commit |= draw_command(target, commands + offset);
+    }
+
+    return commit ? 1 : 0;
+}
+
+// Opcode and arguments, 0 for anything malformed or cut off
+static size_t draw_command_size(const u8 *command, size_t remaining)
+{
+    static const u8 arguments[LCD_DRAW_OPCODES] = {
+        [LCD_DRAW_CLEAR] = 4,
+        [LCD_DRAW_TEXT] = 4,
+        [LCD_DRAW_LINE] = 4,
+        [LCD_DRAW_RECT] = 5,
+        [LCD_DRAW_BLIT] = 4,
+        [LCD_DRAW_INVERT] = 4,
+        [LCD_DRAW_COMMIT] = 0,
+    };
+    size_t size;
+
+    if (command[0] == 0 || command[0] >= LCD_DRAW_OPCODES)
+    {
+        return 0;
+    }
+
+    size = 1 + arguments[command[0]];
+    if (size > remaining)
+    {
+        return 0;
+    }
+
+    switch (command[0])
+    {
+    case LCD_DRAW_TEXT:
+        if (command[3] == 0 || command[3] > MAX_FONT_SCALE)
+        {
+            return 0;
+        }
+
+        size += command[4];
+        break;
+    case LCD_DRAW_RECT:
+        if (command[5] > 1)
+        {
+            return 0;
+        }
+        break;
+    case LCD_DRAW_BLIT:
+        size += DIV_ROUND_UP((size_t)command[3], 8) * command[4];
+        break;
+    }
+
+    return size <= remaining ? size : 0;
+}
+
+static bool draw_command(char *target, const u8 *command)
+{
+    switch (command[0])
+    {
+    case LCD_DRAW_CLEAR:
+        fill_rectangle(target, command[1], command[2], command[3], command[4], PIXEL_CLEAR);
+        break;
+    case LCD_DRAW_TEXT:
+        draw_text(target, command);
+        break;
+    case LCD_DRAW_LINE:
+        draw_line(target, command[1], command[2], command[3], command[4]);
+        break;
+    case LCD_DRAW_RECT:
+        if (command[5] == 1)
+        {
+            fill_rectangle(target, command[1], command[2], command[3], command[4], PIXEL_SET);
+        }
+        else if (command[3] > 0 && command[4] > 0)
+        {
+            fill_rectangle(target, command[1], command[2], command[3], 1, PIXEL_SET);
+            fill_rectangle(target, command[1], command[2] + command[4] - 1, command[3], 1, PIXEL_SET);
+            fill_rectangle(target, command[1], command[2], 1, command[4], PIXEL_SET);
+            fill_rectangle(target, command[1] + command[3] - 1, command[2], 1, command[4], PIXEL_SET);
+        }
+        break;
+    case LCD_DRAW_BLIT:
+        draw_bitmap(target, command);
+        break;
+    case LCD_DRAW_INVERT:
+        fill_rectangle(target, command[1], command[2], command[3], command[4], PIXEL_INVERT);
+        break;
+    case LCD_DRAW_COMMIT:
+        return true;
+    }
+
+    return false;
+}
+
+// Clipped to the GRAM, damages the pixel's column
+static void plot(char *target, int x, int y, enum pixel_operation operation)
+{
+    char *byte;
+    char bit;
+
+    if (x < 0 || y < 0 || x >= (int)SCREEN_WIDTH || y >= (int)SCREEN_ROWS)
+    {
+        return;
+    }
+
+    byte = target + x + (SCREEN_WIDTH * (y / 8));
+    bit = (char)(1 << (y % 8));
+
+    switch (operation)
+    {
+    case PIXEL_CLEAR:
+        *byte &= ~bit;
+        break;
+    case PIXEL_SET:
+        *byte |= bit;
+        break;
+    case PIXEL_INVERT:
+        *byte ^= bit;
+        break;
+    }
+
+    __set_bit(x, damaged_columns[y / 8]);
+}
+
+static void fill_rectangle(char *target, int x, int y, int width, int height, enum pixel_operation operation)
+{
+    int row;
+    int column;
+
+    for (row = y; row < y + height && row < (int)SCREEN_ROWS; row++)
+    {
+        for (column = x; column < x + width && column < (int)SCREEN_WIDTH; column++)
+        {
+            plot(target, column, row, operation);
+        }
+    }
+}
+
+static void draw_line(char *target, int x0, int y0, int x1, int y1)
+{
+    int dx = abs(x1 - x0);
+    int dy = -abs(y1 - y0);
+    int step_x = x0 < x1 ? 1 : -1;
+    int step_y = y0 < y1 ? 1 : -1;
+    int error = dx + dy;
+
+    for (;;)
+    {
+        plot(target, x0, y0, PIXEL_SET);
+
+        if (x0 == x1 && y0 == y1)
+        {
+            break;
+        }
+
+        if (2 * error >= dy)
+        {
+            error += dy;
+            x0 += step_x;
+        }
+
+        if (2 * error <= dx)
+        {
+            error += dx;
+            y0 += step_y;
+        }
+    }
+}
+
+// Character cells like a region's, on a pane that covers the whole GRAM
+static void draw_text(char *target, const u8 *command)
+{
+    struct lcd_region pane = {
+        .first_page = 0,
+        .last_page = SCREEN_PAGES - 1,
+        .first_column = 0,
+        .last_column = SCREEN_WIDTH - 1,
+        .scale = command[3],
+        .x = command[1],
+        .y = command[2],
+    };
+    const char *text = (const char *)command + 5;
+    size_t length = command[4];
+    size_t first_column = pane.x;
+    size_t page;
+    size_t i;
+
+    for (i = 0; i < length && pane.x < SCREEN_WIDTH; i++)
+    {
+        if (text[i] < ' ' || text[i] > '~')
+        {
+            continue;
+        }
+
+        draw_glyph(target, &pane, text[i]);
+        pane.x += CHARACTER_SPACE * pane.scale;
+    }
+
+    if (pane.x == first_column)
+    {
+        return;
+    }
+
+    for (page = pane.y / 8; page < SCREEN_PAGES && page <= (pane.y + (CHARACTER_HEIGHT * pane.scale) - 1) / 8; page++)
+    {
+        mark_damage(page, first_column, min(pane.x, SCREEN_WIDTH) - 1);
+    }
+}
+
+static void draw_bitmap(char *target, const u8 *command)
+{
+    const u8 *bits = command + 5;
+    size_t stride = DIV_ROUND_UP((size_t)command[3], 8);
+    size_t row;
+    size_t column;
+    bool set;
+
+    for (row = 0; row < command[4]; row++)
+    {
+        for (column = 0; column < command[3]; column++)
+        {
+            set = (bits[(row * stride) + (column / 8)] >> (7 - (column % 8))) & 1;
+            plot(target, command[1] + column, command[2] + row, set ? PIXEL_SET : PIXEL_CLEAR);
+        }
+    }
+}
+#pragma endregion
+
+#pragma region frame_lcd
+// Returns what the panel shows, or the frame still being committed after a failed transfer
+static ssize_t read_frame_lcd(struct file *file, struct kobject *kobject, struct bin_attribute *attribute,
+                              char *buffer, loff_t offset, size_t size)
+{
+    mutex_lock(&lcd_mutex);
+    memcpy(buffer, (shadow_valid ? shadow_gram : screen_buffer) + offset, size);
+    mutex_unlock(&lcd_mutex);
+
+    return size;
+}
+
+// The offset and size map straight onto a page/column window, only that window is marked damaged and
+// the shadow diff drops whatever did not change
+static ssize_t write_frame_lcd(struct file *file, struct kobject *kobject, struct bin_attribute *attribute,
+                               char *buffer, loff_t offset, size_t size)
+{
+    ktime_t start = ktime_get();
+    size_t first = (size_t)offset; // sysfs keeps offset + size within SCREEN_BUFFER_SIZE
+
+    if (enable_console)
+    {
+        return -EBUSY;
+    }
+
+    if (size == 0)
+    {
+        return 0;
+    }
+
+    trace_lcd_display_write("frame", size, task_pid_nr(current));
+    atomic64_inc(&statistics.writes);
+
+    mutex_lock(&frame_mutex);
+    capture_request(CAPTURE_FRAME, offset, buffer, size);
+    record_latency(statistics.queue_time, start);
+
+    memcpy(base_layer + first, buffer, size);
+    mark_range_damaged(first, size);
+    commit_frame(LCD_PRIORITY_NORMAL);
+    mutex_unlock(&frame_mutex);
+
+    return size;
+}
+#pragma endregion
+
+#pragma region compositor
+// A new layer starts hidden, opening the device does not blank the panel before the first write
+static int layer_open(struct inode *inode, struct file *file)
+{
+    struct lcd_layer *layer;
+
+    if (enable_console)
+    {
+        return -EBUSY;
+    }
+
+    layer = kzalloc(sizeof(*layer), GFP_KERNEL);
+    if (layer == NULL)
+    {
+        return -ENOMEM;
+    }
+
+    init_layer(layer);
+    memset(layer->mask, 0xFF, sizeof(layer->mask));
+
+    mutex_lock(&frame_mutex);
+    place_layer(layer);
+    mutex_unlock(&frame_mutex);
+
+    file->private_data = layer;
+    return 0;
+}
+
+static int layer_release(struct inode *inode, struct file *file)
+{
+    struct lcd_layer *layer = file->private_data;
+
+    // The restore work takes frame_mutex itself
+    hrtimer_cancel(&layer->expiry);
+    cancel_work_sync(&layer->restore_work);
+
+    mutex_lock(&frame_mutex);
+    list_del(&layer->node);
+    drop_queued_frames(layer);
+
+    if (layer->priority == LCD_PRIORITY_HIGH)
+    {
+        atomic_dec(&urgent_layers);
+    }
+
+    if (layer->visible && !panel_gone)
+    {
+        damage_layer(layer);
+        commit_frame(layer->priority);
+    }
+    mutex_unlock(&frame_mutex);
+
+    // The present work may still hold frames it took off the queue for this layer
+    flush_work(&present_work);
+
+    kfree(layer);
+    return 0;
+}
+
+static ssize_t layer_read(struct file *file, char __user *buffer, size_t size, loff_t *offset)
+{
+    struct lcd_layer *layer = file->private_data;
+    ssize_t result;
+
+    mutex_lock(&frame_mutex);
+    result = simple_read_from_buffer(buffer, size, offset, layer->pixels, sizeof(layer->pixels));
+    mutex_unlock(&frame_mutex);
+
+    return result;
+}
+
+// Same layout and partial writes as the frame attribute, only a visible layer commits a frame
+static ssize_t layer_write(struct file *file, const char __user *buffer, size_t size, loff_t *offset)
+{
+    struct lcd_layer *layer = file->private_data;
+    ktime_t start = ktime_get();
+    size_t first;
+    char *pixels;
+
+    if (*offset < 0 || *offset >= SCREEN_BUFFER_SIZE)
+    {
+        return size == 0 ? 0 : -ENOSPC;
+    }
+
+    first = (size_t)*offset;
+    size = min(size, SCREEN_BUFFER_SIZE - first);
+    if (size == 0)
+    {
+        return 0;
+    }
+
+    // Copied up front, a fault halfway leaves the layer as it was instead of half written
+    pixels = memdup_user(buffer, size);
+    if (IS_ERR(pixels))
+    {
+        return PTR_ERR(pixels);
+    }
+
+    trace_lcd_display_write("layer", size, task_pid_nr(current));
+    atomic64_inc(&statistics.writes);
+
+    mutex_lock(&frame_mutex);
+    if (panel_gone)
+    {
+        mutex_unlock(&frame_mutex);
+        kfree(pixels);
+        return -ENODEV;
+    }
+
+    record_latency(statistics.queue_time, start);
+    memcpy(layer->pixels + first, pixels, size);
+
+    if (layer->visible)
+    {
+        mark_range_damaged(first, size);
+        atomic64_set(&layer->sequence, commit_frame(layer->priority));
+    }
+    mutex_unlock(&frame_mutex);
+    kfree(pixels);
+
+    *offset += size;
+    return size;
+}
+
+static long layer_ioctl(struct file *file, unsigned int command, unsigned long argument)
+{
+    struct lcd_layer *layer = file->private_data;
+    struct lcd_layer_info info;
+    struct lcd_sequence sequence;
+    struct lcd_presentation presentation;
+    u32 milliseconds;
+    u32 priority;
+
+    if (READ_ONCE(panel_gone))
+    {
+        return -ENODEV;
+    }
+
+    switch (command)
+    {
+    case LCD_GET_LAYER:
+        mutex_lock(&frame_mutex);
+        info.z = layer->z;
+        info.flags = layer->visible ? LCD_LAYER_VISIBLE : 0;
+        mutex_unlock(&frame_mutex);
+
+        return copy_to_user((void __user *)argument, &info, sizeof(info)) != 0 ? -EFAULT : 0;
+    case LCD_SET_LAYER:
+        if (copy_from_user(&info, (const void __user *)argument, sizeof(info)) != 0)
+        {
+            return -EFAULT;
+        }
+
+        return set_layer(layer, &info);
+    case LCD_SET_MASK:
+        return set_mask(layer, (const struct lcd_layer_mask __user *)argument);
+    case LCD_SHOW_TIMED:
+        if (copy_from_user(&milliseconds, (const void __user *)argument, sizeof(milliseconds)) != 0)
+        {
+            return -EFAULT;
+        }
+
+        mutex_lock(&frame_mutex);
+        show_layer_for(layer, milliseconds);
+        atomic64_set(&layer->sequence, commit_frame(layer->priority));
+        mutex_unlock(&frame_mutex);
+
+        return 0;
+    case LCD_GET_SEQUENCE:
+        sequence.committed = atomic64_read(&layer->sequence);
+        sequence.flushed = atomic64_read(&flushed_seq);
+
+        return copy_to_user((void __user *)argument, &sequence, sizeof(sequence)) != 0 ? -EFAULT : 0;
+    case LCD_QUEUE_FRAME:
+        return queue_frame(layer, (const struct lcd_timed_frame __user *)argument);
+    case LCD_GET_PRESENTATION:
+        mutex_lock(&frame_mutex);
+        presentation = layer->presentation;
+        mutex_unlock(&frame_mutex);
+
+        return copy_to_user((void __user *)argument, &presentation, sizeof(presentation)) != 0 ? -EFAULT : 0;
+    case LCD_SET_PRIORITY:
+        if (copy_from_user(&priority, (const void __user *)argument, sizeof(priority)) != 0)
+        {
+            return -EFAULT;
+        }
+
+        if (priority >= UPDATE_PRIORITIES)
+        {
+            return -EINVAL;
+        }
+
+        mutex_lock(&frame_mutex);
+        if (priority != layer->priority)
+        {
+            atomic_add(priority == LCD_PRIORITY_HIGH ? 1 : -1, &urgent_layers);
+            layer->priority = priority;
+        }
+        mutex_unlock(&frame_mutex);
+
+        return 0;
+    case LCD_DRAW:
+        return draw_layer(layer, (const struct lcd_draw_buffer __user *)argument);
+    default:
+        return -ENOTTY;
+    }
+}
+
+// Writable once everything committed through this file is on the panel
+static __poll_t layer_poll(struct file *file, poll_table *wait)
+{
+    struct lcd_layer *layer = file->private_data;
+    __poll_t events = 0;
+
+    poll_wait(file, &flush_wait, wait);
+
+    if (atomic64_read(&flushed_seq) >= atomic64_read(&layer->sequence))
+    {
+        events |= EPOLLOUT | EPOLLWRNORM;
+    }
+
+    if (READ_ONCE(flush_error) < 0)
+    {
+        events |= EPOLLERR;
+    }
+
+    return events;
+}
+
+// Restacks the layer and damages what it covered before and covers now, so showing or hiding an
+// overlay only sends the overlay's area
+static long set_layer(struct lcd_layer *layer, const struct lcd_layer_info *info)
+{
+    if (info->flags & ~LCD_LAYER_VISIBLE)
+    {
+        return -EINVAL;
+    }
+
+    mutex_lock(&frame_mutex);
+    if (layer->visible)
+    {
+        damage_layer(layer);
+    }
+
+    list_del(&layer->node);
+    layer->z = info->z;
+    layer->visible = info->flags & LCD_LAYER_VISIBLE;
+    layer->expires = 0;
+    place_layer(layer);
+
+    if (layer->visible)
+    {
+        damage_layer(layer);
+    }
+
+    atomic64_set(&layer->sequence, commit_frame(layer->priority));
+    mutex_unlock(&frame_mutex);
+
+    return 0;
+}
+
+static long set_mask(struct lcd_layer *layer, const struct lcd_layer_mask __user *mask)
+{
+    int result;
+
+    mutex_lock(&frame_mutex);
+    if (layer->visible)
+    {
+        damage_layer(layer);
+    }
+
+    // A faulting copy leaves the rest of the mask cleared, the damage covers both masks either way
+    result = copy_from_user(layer->mask, mask->bits, sizeof(layer->mask)) != 0 ? -EFAULT : 0;
+
+    if (layer->visible)
+    {
+        damage_layer(layer);
+        atomic64_set(&layer->sequence, commit_frame(layer->priority));
+    }
+    mutex_unlock(&frame_mutex);
+
+    return result;
+}
+
+static void init_layer(struct lcd_layer *layer)
+{
+    hrtimer_init(&layer->expiry, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+    layer->expiry.function = layer_expired;
+    INIT_WORK(&layer->restore_work, restore_under_layer);
+}
+
+// Shows the layer and arms its expiry, 0 milliseconds shows it until it is hidden
+static void show_layer_for(struct lcd_layer *layer, u32 milliseconds)
+{
+    layer->visible = true;
+    damage_layer(layer);
+
+    if (milliseconds == 0)
+    {
+        layer->expires = 0;
+        hrtimer_try_to_cancel(&layer->expiry);
+        return;
+    }
+
+    layer->expires = ktime_add_ns(ktime_get(), (u64)milliseconds * NSEC_PER_MSEC);
+    hrtimer_start(&layer->expiry, layer->expires, HRTIMER_MODE_ABS);
+}
+
+// Runs in hard interrupt context, the flush has to wait for process context
+static enum hrtimer_restart layer_expired(struct hrtimer *timer)
+{
+    struct lcd_layer *layer = container_of(timer, struct lcd_layer, expiry);
+
+    queue_work(system_highpri_wq, &layer->restore_work);
+    return HRTIMER_NORESTART;
+}
+
+// Hides the layer unless it was shown again since the timer fired. The flush runs right here
+// instead of on the commit worker, so the restore does not queue behind other work.
+static void restore_under_layer(struct work_struct *work)
+{
+    struct lcd_layer *layer = container_of(work, struct lcd_layer, restore_work);
+    bool expired;
+    ktime_t expires;
+
+    mutex_lock(&frame_mutex);
+    expires = layer->expires;
+    expired = !panel_gone && layer->visible && expires != 0 && ktime_compare(ktime_get(), expires) >= 0;
+
+    if (expired)
+    {
+        layer->visible = false;
+        layer->expires = 0;
+        damage_layer(layer);
+        atomic64_inc(&statistics.overlays_expired);
+        count_overlay_urgency();
+    }
+    mutex_unlock(&frame_mutex);
+
+    // Unpowered the damage stays marked and goes out with the next flush
+    if (expired && lcd_power_get() == 0)
+    {
+        mutex_lock(&lcd_mutex);
+        flush_screen();
+        mutex_unlock(&lcd_mutex);
+
+        record_latency(statistics.restore_time, expires);
+        lcd_power_put();
+    }
+}
+
+// Above every layer with a lower or the same z
+static void place_layer(struct lcd_layer *layer)
+{
+    struct lcd_layer *below;
+
+    list_for_each_entry_reverse(below, &layers, node)
+    {
+        if (below->z <= layer->z)
+        {
+            list_add(&layer->node, &below->node);
+            return;
+        }
+    }
+
+    list_add(&layer->node, &layers);
+}
+
+// Marks the columns between the first and the last set mask byte of every page
+static void damage_layer(const struct lcd_layer *layer)
+{
+    const char *mask;
+    size_t page;
+    size_t first;
+    size_t last;
+
+    for (page = 0; page < SCREEN_PAGES; page++)
     {
-        lcd_display_state = 1;
+        mask = layer->mask + (SCREEN_WIDTH * page);
+
+        for (first = 0; first < SCREEN_WIDTH && mask[first] == 0; first++)
+        {
+        }
+
+        if (first == SCREEN_WIDTH)
+        {
+            continue;
+        }
+
+        for (last = SCREEN_WIDTH - 1; mask[last] == 0; last--)
+        {
+        }
+
+        mark_damage(page, first, last);
+    }
+}
+#pragma endregion
+
+#pragma region presentation
+static long queue_frame(struct lcd_layer *layer, const struct lcd_timed_frame __user *timed)
+{
+    struct scheduled_frame *frame = kmalloc(sizeof(*frame), GFP_KERNEL);
+    struct scheduled_frame *later;
+    u64 target_ns;
+
+    if (frame == NULL)
+    {
+        return -ENOMEM;
+    }
+
+    if (copy_from_user(&target_ns, &timed->target_ns, sizeof(target_ns)) != 0 ||
+        copy_from_user(frame->pixels, timed->pixels, sizeof(frame->pixels)) != 0)
+    {
+        kfree(frame);
+        return -EFAULT;
+    }
+
+    mutex_lock(&frame_mutex);
+    if (layer->queued >= MAX_QUEUED_FRAMES)
+    {
+        mutex_unlock(&frame_mutex);
+        kfree(frame);
+        return -EBUSY;
+    }
+
+    frame->layer = layer;
+    frame->target = ns_to_ktime(target_ns);
+    frame->start = ktime_sub_ns(frame->target, estimate_present_ns(layer));
+
+    // Behind every frame that starts at the same time, so one layer's frames keep their order
+    list_for_each_entry(later, &scheduled_frames, node)
+    {
+        if (ktime_before(frame->start, later->start))
+        {
+            break;
+        }
+    }
+
+    list_add_tail(&frame->node, &later->node);
+    layer->queued++;
+    arm_presentation();
+    mutex_unlock(&frame_mutex);
+
+    return 0;
+}
+
+// Drops the frames layer queued, or every queued frame when layer is NULL
+static void drop_queued_frames(struct lcd_layer *layer)
+{
+    struct scheduled_frame *frame;
+    struct scheduled_frame *next;
+
+    list_for_each_entry_safe(frame, next, &scheduled_frames, node)
+    {
+        if (layer == NULL || frame->layer == layer)
+        {
+            frame->layer->queued = 0;
+            list_del(&frame->node);
+            kfree(frame);
+        }
+    }
+}
+
+// What sending the layer's area costs at the measured throughput: the masked columns of every
+// visible page with a window address and a transaction in front of them
+static u64 estimate_present_ns(const struct lcd_layer *layer)
+{
+    u32 throughput = READ_ONCE(measured_throughput);
+    size_t overhead = READ_ONCE(transaction_overhead);
+    size_t bytes = 0;
+    size_t columns;
+    size_t page;
+    size_t column;
+
+    if (throughput == 0)
+    {
+        throughput = bus_frequency / I2C_BITS_PER_BYTE;
+    }
+
+    for (page = 0; page < VISIBLE_PAGES; page++)
+    {
+        columns = 0;
+        for (column = 0; column < SCREEN_WIDTH; column++)
+        {
+            columns += layer->mask[column + (SCREEN_WIDTH * page)] != 0;
+        }
+
+        if (columns > 0)
+        {
+            bytes += columns + WINDOW_ADDRESS_BYTES + (2 * overhead);
+        }
+    }
+
+    return div_u64((u64)bytes * NSEC_PER_SEC, max_t(u32, throughput, 1)) + PRESENT_MARGIN_NS;
+}
+
+// Called with frame_mutex held whenever the head of the queue may have changed
+static void arm_presentation(void)
+{
+    struct scheduled_frame *next = list_first_entry_or_null(&scheduled_frames, struct scheduled_frame, node);
+
+    if (next != NULL && !panel_gone)
+    {
+        hrtimer_start(&present_timer, next->start, HRTIMER_MODE_ABS);
+    }
+}
+
+static enum hrtimer_restart presentation_due(struct hrtimer *timer)
+{
+    queue_work(system_highpri_wq, &present_work);
+    return HRTIMER_NORESTART;
+}
+
+// Takes every frame whose start time has passed off the queue and sends them as one flush. A
+// frame that is already later than its transfer can make up for is dropped instead, the next one
+// of its layer follows on time rather than everything after it sliding.
+static void present_frames(struct work_struct *work)
+{
+    LIST_HEAD(presenting);
+    struct scheduled_frame *frame;
+    struct scheduled_frame *next;
+    struct lcd_layer *layer;
+    ktime_t now = ktime_get();
+    ktime_t presented;
+    u64 sequence = 0;
+    int result = 0;
+
+    mutex_lock(&frame_mutex);
+    list_for_each_entry_safe(frame, next, &scheduled_frames, node)
+    {
+        if (ktime_after(frame->start, now))
+        {
+            break;
+        }
+
+        layer = frame->layer;
+        list_del(&frame->node);
+        layer->queued--;
+
+        if (ktime_to_ns(ktime_sub(now, frame->start)) > PRESENT_LATE_NS)
+        {
+            layer->presentation.dropped++;
+            atomic64_inc(&statistics.frames_late);
+            trace_lcd_frame_dropped("late");
+            kfree(frame);
+            continue;
+        }
+
+        memcpy(layer->pixels, frame->pixels, sizeof(layer->pixels));
+        if (layer->visible)
+        {
+            damage_layer(layer);
+            sequence = sequence == 0 ? atomic64_inc_return(&committed_seq) : sequence;
+            atomic64_set(&layer->sequence, sequence);
+        }
+
+        list_add_tail(&frame->node, &presenting);
+    }
+
+    arm_presentation();
+    mutex_unlock(&frame_mutex);
+
+    if (list_empty(&presenting))
+    {
+        return;
+    }
+
+    // Flushed right here like an overlay restore, the commit worker may be busy with other frames
+    if (sequence != 0)
+    {
+        result = lcd_power_get();
+        if (result == 0)
+        {
+            mutex_lock(&lcd_mutex);
+            result = flush_screen();
+            mutex_unlock(&lcd_mutex);
+
+            lcd_power_put();
+        }
+
+        WRITE_ONCE(flush_error, result);
+    }
+
+    presented = ktime_get();
+
+    mutex_lock(&frame_mutex);
+    list_for_each_entry_safe(frame, next, &presenting, node)
+    {
+        layer = frame->layer;
+        layer->presentation.target_ns = ktime_to_ns(frame->target);
+        layer->presentation.actual_ns = ktime_to_ns(presented);
+        layer->presentation.presented++;
+
+        atomic64_inc(&statistics.frames_presented);
+        record_latency(statistics.present_lateness, frame->target);
+        kfree(frame);
+    }
+    mutex_unlock(&frame_mutex);
+}
+#pragma endregion
+
+#pragma region console
+static void console_write(struct console *console, const char *text, unsigned int count)
+{
+    unsigned long flags;
+    size_t dropped = 0;
+    unsigned int i;
+
+    spin_lock_irqsave(&console_text_lock, flags);
+    for (i = 0; i < count; i++)
+    {
+        console_text[console_head % CONSOLE_BUFFER_BYTES] = text[i];
+        console_head++;
+
+        if (console_head - console_tail > CONSOLE_BUFFER_BYTES)
+        {
+            console_tail++;
+            dropped++;
+        }
+    }
+    spin_unlock_irqrestore(&console_text_lock, flags);
+
+    if (dropped > 0)
+    {
+        atomic64_add(dropped, &statistics.console_dropped);
+    }
+
+    // Already pending it keeps its time, everything logged until then goes out with that repaint
+    schedule_delayed_work(&console_work, msecs_to_jiffies(CONSOLE_INTERVAL_MS));
+}
+
+// Draws what was logged since the last repaint and scrolls it into view once it is on the panel,
+// so the start line never shows a page that is still being written
+static void repaint_console(struct work_struct *work)
+{
+    static char text[CONSOLE_BUFFER_BYTES];
+    unsigned long flags;
+    size_t length = 0;
+    size_t top;
+
+    spin_lock_irqsave(&console_text_lock, flags);
+    while (console_tail != console_head)
+    {
+        text[length++] = console_text[console_tail % CONSOLE_BUFFER_BYTES];
+        console_tail++;
+    }
+    spin_unlock_irqrestore(&console_text_lock, flags);
+
+    if (length == 0)
+    {
+        return;
+    }
+
+    mutex_lock(&frame_mutex);
+    render_console(text, length);
+    top = console_top;
+    mutex_unlock(&frame_mutex);
+
+    atomic64_inc(&statistics.console_repaints);
+
+    // Unpowered the console stays drawn and goes out with the next flush
+    if (lcd_power_get() == 0)
+    {
+        mutex_lock(&lcd_mutex);
+        if (flush_screen() == 0)
+        {
+            write_start_line(top * 8);
+        }
+        mutex_unlock(&lcd_mutex);
+
+        lcd_power_put();
+    }
+}
+
+// Only the last lines can still be on screen, whatever scrolls out before the repaint is skipped
+static void render_console(const char *text, size_t length)
+{
+    const char *glyph;
+    size_t lines = 0;
+    size_t first = length - 1;
+    size_t i;
+
+    while (first > 0)
+    {
+        first--;
+        if (text[first] == '\n' && ++lines == VISIBLE_PAGES)
+        {
+            first++;
+            console_newline_pending = true;
+            break;
+        }
+    }
+
+    for (i = first; i < length; i++)
+    {
+        // A line break waits for the next character, so the last line logged is not followed by an
+        // empty one taking up a quarter of the screen
+        if (text[i] == '\n')
+        {
+            if (console_newline_pending)
+            {
+                console_newline();
+            }
+
+            console_newline_pending = true;
+            continue;
+        }
+
+        if (text[i] < ' ' || text[i] > '~')
+        {
+            continue;
+        }
+
+        if (console_newline_pending || console_column == CONSOLE_COLUMNS)
+        {
+            console_newline();
+            console_newline_pending = false;
+        }
+
+        glyph = characters + ((text[i] - ' ') * CHARACTER_BYTES);
+        memcpy(base_layer + (console_column * CHARACTER_SPACE) + (SCREEN_WIDTH * console_page), glyph, CHARACTER_BYTES);
+        mark_damage(console_page, console_column * CHARACTER_SPACE, (console_column * CHARACTER_SPACE) + CHARACTER_BYTES - 1);
+        console_column++;
+    }
+}
+
+// Moves to the next GRAM page, cleared, and scrolls once the visible pages are full
+static void console_newline(void)
+{
+    console_page = (console_page + 1) % SCREEN_PAGES;
+    console_column = 0;
+
+    memset(base_layer + (SCREEN_WIDTH * console_page), 0x00, SCREEN_WIDTH);
+    mark_damage(console_page, 0, SCREEN_WIDTH - 1);
+
+    if (console_lines < VISIBLE_PAGES)
+    {
+        console_lines++;
     }
     else
     {
-        return -1;
+        console_top = (console_top + 1) % SCREEN_PAGES;
     }
+}
 
-    send_buffer[1] |= lcd_display_state;
+static int write_start_line(unsigned int line)
+{
+    char set_start_line[] = {COMMAND, (char)(SET_START_LINE | line)};
 
-    result = i2c_master_send(lcd_i2c_client, send_buffer, sizeof(send_buffer));
+    start_line = line;
+    return write_setting(CACHED_START_LINE, line, set_start_line, sizeof(set_start_line));
+}
+#pragma endregion
 
-    return size;
+#pragma region status_lcd
+static ssize_t show_bus_frequency_lcd(struct device_driver *device, char *buffer)
+{
+    return sprintf(buffer, "%u\n", bus_frequency);
+}
+
+static ssize_t show_throughput_lcd(struct device_driver *device, char *buffer)
+{
+    return sprintf(buffer, "%u\n", measured_throughput);
+}
+
+static ssize_t show_max_transfer_lcd(struct device_driver *device, char *buffer)
+{
+    return sprintf(buffer, "%zu\n", max_transfer);
+}
+
+static ssize_t show_resume_latency_lcd(struct device_driver *device, char *buffer)
+{
+    return sprintf(buffer, "%u\n", resume_latency);
+}
+
+// Both count frames since the driver was loaded, every change of flushed_seq is sysfs_notify()'d
+static ssize_t show_committed_seq_lcd(struct device *device, struct device_attribute *attribute, char *buffer)
+{
+    return sprintf(buffer, "%lld\n", atomic64_read(&committed_seq));
+}
+
+static ssize_t show_flushed_seq_lcd(struct device *device, struct device_attribute *attribute, char *buffer)
+{
+    return sprintf(buffer, "%lld\n", atomic64_read(&flushed_seq));
 }
 #pragma endregion
 
-#pragma region lcd_display
+#pragma region statistics
+// Bucket n counts durations below 2^n microseconds that did not fit bucket n - 1
+static void record_latency(atomic64_t *histogram, ktime_t start)
+{
+    s64 elapsed = ktime_us_delta(ktime_get(), start);
+    size_t bucket = elapsed > 0 ? min_t(size_t, fls64(elapsed), HISTOGRAM_BUCKETS - 1) : 0;
 
-static ssize_t store_display_lcd(struct device_driver *device, const char *buffer, size_t size)
+    atomic64_inc(&histogram[bucket]);
+}
+
+static void show_histogram(struct seq_file *file, const char *name, atomic64_t *histogram)
 {
-    int i;
-    char current_char;
-    size_t character_offset;
+    size_t bucket;
+    s64 count;
 
-    reset_screen();
+    seq_printf(file, "%s_us:\n", name);
 
-    for (i = 0; i < size; i++)
+    for (bucket = 0; bucket < HISTOGRAM_BUCKETS; bucket++)
     {
-        current_char = buffer[i];
+        count = atomic64_read(&histogram[bucket]);
 
-        if (current_char == '\n' || x >= (SCREEN_WIDTH - CHARACTER_SPACE))
+        if (count == 0)
         {
-            x = 0;
-            y += 1;
+            continue;
         }
 
-        if (current_char >= ' ' && current_char <= '~' && !(x == 0 && current_char == ' '))
+        if (bucket == HISTOGRAM_BUCKETS - 1)
         {
-            character_offset = (current_char - ' ') * CHARACTER_BYTES;
-            memcpy(screen_buffer + (x + (SCREEN_WIDTH * y)), characters + character_offset, CHARACTER_BYTES);
-            x += CHARACTER_SPACE;
+            seq_printf(file, "  >= %llu: %lld\n", 1ULL << (bucket - 1), count);
+        }
+        else
+        {
+            seq_printf(file, "  < %llu: %lld\n", 1ULL << bucket, count);
         }
     }
+}
+
+static int statistics_show(struct seq_file *file, void *data)
+{
+    seq_printf(file, "writes: %lld\n", atomic64_read(&statistics.writes));
+    seq_printf(file, "frames_committed: %lld\n", atomic64_read(&statistics.frames_committed));
+    seq_printf(file, "frames_coalesced: %lld\n", atomic64_read(&statistics.frames_coalesced));
+    seq_printf(file, "frames_identical: %lld\n", atomic64_read(&statistics.frames_identical));
+    seq_printf(file, "bytes: %lld\n", atomic64_read(&statistics.bytes));
+    seq_printf(file, "transactions: %lld\n", atomic64_read(&statistics.transactions));
+    seq_printf(file, "i2c_errors: %lld\n", atomic64_read(&statistics.i2c_errors));
+    seq_printf(file, "i2c_retries: %lld\n", atomic64_read(&statistics.i2c_retries));
+    seq_printf(file, "overlays_expired: %lld\n", atomic64_read(&statistics.overlays_expired));
+    seq_printf(file, "frames_presented: %lld\n", atomic64_read(&statistics.frames_presented));
+    seq_printf(file, "frames_late: %lld\n", atomic64_read(&statistics.frames_late));
+    seq_printf(file, "flushes_preempted: %lld\n", atomic64_read(&statistics.flushes_preempted));
+    seq_printf(file, "console_repaints: %lld\n", atomic64_read(&statistics.console_repaints));
+    seq_printf(file, "console_dropped: %lld\n", atomic64_read(&statistics.console_dropped));
+
+    show_histogram(file, "render_time", statistics.render_time);
+    show_histogram(file, "queue_time", statistics.queue_time);
+    show_histogram(file, "flush_time", statistics.flush_time);
+    show_histogram(file, "restore_time", statistics.restore_time);
+    show_histogram(file, "present_lateness", statistics.present_lateness);
+    show_histogram(file, "pixel_time_normal", statistics.pixel_time[LCD_PRIORITY_NORMAL]);
+    show_histogram(file, "pixel_time_high", statistics.pixel_time[LCD_PRIORITY_HIGH]);
+
+    return 0;
+}
+
+static int statistics_open(struct inode *inode, struct file *file)
+{
+    return single_open(file, statistics_show, inode->i_private);
+}
+
+static ssize_t statistics_reset_write(struct file *file, const char __user *buffer, size_t size, loff_t *offset)
+{
+    // lcd_statistics holds nothing but atomic64_t counters
+    atomic64_t *counter = (atomic64_t *)&statistics;
+    size_t i;
+
+    for (i = 0; i < sizeof(statistics) / sizeof(atomic64_t); i++)
+    {
+        atomic64_set(&counter[i], 0);
+    }
 
-    write_buffer_to_screen();
     return size;
 }
 
+static void create_debugfs(void)
+{
+    debugfs_root = debugfs_create_dir(dev_name(&lcd_i2c_client->dev), debugfs_driver_root);
+    debugfs_create_file("statistics", 00444, debugfs_root, NULL, &statistics_fops);
+    debugfs_create_file("reset", 00200, debugfs_root, NULL, &statistics_reset_fops);
+    debugfs_create_file("record", 00600, debugfs_root, NULL, &record_fops);
+    debugfs_create_file("recording", 00400, debugfs_root, NULL, &recording_fops);
+    debugfs_create_file("capture", 00600, debugfs_root, NULL, &capture_fops);
+    debugfs_create_file("capture_log", 00400, debugfs_root, NULL, &capture_log_fops);
+}
+#pragma endregion
+
+#pragma region bus_load
+// calc_load() on 64 bits, byte rates in fixed point overflow an unsigned long on 32-bit ARM
+static u64 decay_average(u64 average, unsigned long exponent, u64 sample)
+{
+    u64 decayed = (average * exponent) + (sample * (FIXED_1 - exponent));
+
+    if (sample >= average)
+    {
+        decayed += FIXED_1 - 1;
+    }
+
+    return decayed / FIXED_1;
+}
+
+static void sample_bus_load(struct work_struct *work)
+{
+    ktime_t now = ktime_get();
+    u64 period_ns = max_t(u64, ktime_to_ns(ktime_sub(now, sampled_at)), 1);
+    u64 busy;
+    u64 bytes;
+    size_t i;
+
+    mutex_lock(&lcd_mutex);
+    busy = busy_ns - sampled_busy_ns;
+    bytes = bytes_sent - sampled_bytes;
+    sampled_busy_ns = busy_ns;
+    sampled_bytes = bytes_sent;
+    mutex_unlock(&lcd_mutex);
+
+    sampled_at = now;
+
+    for (i = 0; i < LOAD_AVERAGES; i++)
+    {
+        bus_load[i] = decay_average(bus_load[i], load_exponents[i], div64_u64(busy * 100 * FIXED_1, period_ns));
+        bus_rate[i] = decay_average(bus_rate[i], load_exponents[i], div64_u64(bytes * NSEC_PER_SEC * FIXED_1, period_ns));
+    }
+
+    schedule_delayed_work(&bus_load_work, LOAD_FREQ);
+}
+
+// Bytes per second while the driver actually holds the bus, the self-test result until then
+static u32 busy_throughput(void)
+{
+    u64 bytes;
+    u64 busy;
+
+    mutex_lock(&lcd_mutex);
+    bytes = bytes_sent;
+    busy = busy_ns;
+    mutex_unlock(&lcd_mutex);
+
+    if (busy == 0)
+    {
+        return measured_throughput;
+    }
+
+    return (u32)div64_u64(bytes * NSEC_PER_SEC, busy);
+}
+
+// Percent of wall time spent in I2C transfers, in the fixed point format of loadavg
+static ssize_t show_bus_load_lcd(struct device_driver *device, char *buffer)
+{
+    unsigned long load[LOAD_AVERAGES] = {bus_load[0], bus_load[1], bus_load[2]};
+
+    return sprintf(buffer, "%lu.%02lu %lu.%02lu %lu.%02lu\n",
+                   LOAD_INT(load[0]), LOAD_FRAC(load[0]),
+                   LOAD_INT(load[1]), LOAD_FRAC(load[1]),
+                   LOAD_INT(load[2]), LOAD_FRAC(load[2]));
+}
+
+static ssize_t show_bus_rate_lcd(struct device_driver *device, char *buffer)
+{
+    return sprintf(buffer, "%llu %llu %llu\n",
+                   bus_rate[0] >> FSHIFT, bus_rate[1] >> FSHIFT, bus_rate[2] >> FSHIFT);
+}
+
+static ssize_t show_bus_capacity_lcd(struct device_driver *device, char *buffer)
+{
+    return sprintf(buffer, "%u %u\n", busy_throughput(), bus_frequency / I2C_BITS_PER_BYTE);
+}
+
+static ssize_t show_max_fps_lcd(struct device_driver *device, char *buffer)
+{
+    size_t frame_bytes = WINDOW_ADDRESS_BYTES + transaction_overhead + data_cost(VISIBLE_PAGES * SCREEN_WIDTH);
+
+    return sprintf(buffer, "%zu\n", busy_throughput() / frame_bytes);
+}
 #pragma endregion
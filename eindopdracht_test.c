@@ -0,0 +1,451 @@
+// KUnit suite for the renderer and the flush path. The driver is included as is, its transport
+// swapped for the emulator in ssd1306_emulator.h, so every test sees exactly what a panel would.
+//
+//   make eindopdracht_test.ko   (kernel with CONFIG_KUNIT)
+//   insmod eindopdracht_test.ko && dmesg
+
+#define LCD_DRIVER_KUNIT
+#include "eindopdracht.c"
+
+#include <kunit/test.h>
+
+#include "ssd1306_emulator.h"
+
+/***********************************************************/
+/************************ DEFINES **************************/
+/***********************************************************/
+#define VISIBLE_BYTES (VISIBLE_PAGES * SCREEN_WIDTH)
+#define GLYPHS_PER_LINE ((SCREEN_WIDTH - CHARACTER_SPACE) / CHARACTER_SPACE + 1)
+
+// Bytes on the wire for the standard scenarios, any growth is a regression
+#define SINGLE_CHARACTER_BYTES ((u64)16)
+#define SINGLE_CHARACTER_TRANSACTIONS ((u64)3)
+#define FULL_SCREEN_BYTES ((u64)(VISIBLE_BYTES + 16))
+#define FULL_SCREEN_TRANSACTIONS ((u64)4)
+#define CLEAR_BYTES FULL_SCREEN_BYTES
+
+#define BENCHMARK_ITERATIONS 1000
+#define RENDER_NS_PER_CHARACTER ((u64)1000)
+#define PLAN_NS ((u64)50000)
+
+/***********************************************************/
+/****************** FUNCTION PROTOTYPES ********************/
+/***********************************************************/
+
+static int emulator_transport_send(const char *, size_t);
+static u64 show_text(const char *, u64 *);
+static void reset_console(void);
+static void show_console(const char *);
+static void expect_panel_matches(struct kunit *);
+static void expect_glyph(struct kunit *, size_t, size_t, char);
+
+/***********************************************************/
+/******************** GLOBAL VARIABLES *********************/
+/***********************************************************/
+static struct ssd1306_emulator test_panel;
+
+static const struct lcd_transport emulator_transport = {
+    .name = "emulator",
+    .send = emulator_transport_send,
+};
+
+// "Hi" at the cursor origin, spelled out instead of taken from the font table
+static const unsigned char golden_hi[] = {0x7F, 0x08, 0x08, 0x08, 0x7F, 0x00, 0x00, 0x44, 0x7D, 0x40, 0x00};
+
+/***********************************************************/
+/****************** FUNCTION DEFINITIONS *******************/
+/***********************************************************/
+
+#pragma region helpers
+static int emulator_transport_send(const char *buffer, size_t size)
+{
+    if (ssd1306_emulator_transaction(&test_panel, (const unsigned char *)buffer, size) < 0)
+    {
+        return -EIO;
+    }
+
+    return size;
+}
+
+// What a write to the display attribute does, minus the sysfs and runtime PM around it
+static u64 show_text(const char *text, u64 *transactions)
+{
+    u64 bytes = test_panel.bytes;
+    u64 start_transactions = test_panel.transactions;
+
+    mutex_lock(&frame_mutex);
+    reset_screen();
+    render_text(text, strlen(text));
+    mutex_unlock(&frame_mutex);
+
+    mutex_lock(&lcd_mutex);
+    flush_screen();
+    mutex_unlock(&lcd_mutex);
+
+    if (transactions != NULL)
+    {
+        *transactions = test_panel.transactions - start_transactions;
+    }
+
+    return test_panel.bytes - bytes;
+}
+
+static void reset_console(void)
+{
+    mutex_lock(&frame_mutex);
+    reset_screen();
+    console_page = 0;
+    console_column = 0;
+    console_top = 0;
+    console_lines = 1;
+    console_newline_pending = false;
+    mutex_unlock(&frame_mutex);
+}
+
+// What the console's repaint does with log, minus the ring buffer it comes from
+static void show_console(const char *log)
+{
+    mutex_lock(&frame_mutex);
+    render_console(log, strlen(log));
+    mutex_unlock(&frame_mutex);
+
+    mutex_lock(&lcd_mutex);
+    flush_screen();
+    write_start_line(console_top * 8);
+    mutex_unlock(&lcd_mutex);
+}
+
+static void expect_panel_matches(struct kunit *test)
+{
+    KUNIT_EXPECT_EQ(test, memcmp(test_panel.gram, screen_buffer, SCREEN_BUFFER_SIZE), 0);
+    KUNIT_EXPECT_EQ(test, test_panel.protocol_errors, 0ULL);
+}
+
+static void expect_glyph(struct kunit *test, size_t page, size_t column, char character)
+{
+    const char *glyph = characters + ((character - ' ') * CHARACTER_BYTES);
+
+    KUNIT_EXPECT_EQ(test, memcmp(test_panel.gram + column + (GRAM_WIDTH * page), glyph, CHARACTER_BYTES), 0);
+}
+
+static int lcd_test_init(struct kunit *test)
+{
+    ssd1306_emulator_init(&test_panel);
+
+    mutex_lock(&lcd_mutex);
+    transport = &emulator_transport;
+    max_transfer = SCREEN_BUFFER_SIZE + 1;
+    transaction_overhead = DEFAULT_TRANSACTION_OVERHEAD;
+    lcd_display_state = 1;
+    initialize_screen();
+    mutex_unlock(&lcd_mutex);
+
+    return 0;
+}
+
+static void lcd_test_exit(struct kunit *test)
+{
+    mutex_lock(&lcd_mutex);
+    transport = &i2c_transport;
+    mutex_unlock(&lcd_mutex);
+}
+#pragma endregion
+
+#pragma region golden_frames
+static void render_golden_frame(struct kunit *test)
+{
+    show_text("Hi", NULL);
+
+    KUNIT_EXPECT_EQ(test, memcmp(test_panel.gram, golden_hi, sizeof(golden_hi)), 0);
+    KUNIT_EXPECT_TRUE(test, test_panel.display_on);
+    expect_panel_matches(test);
+}
+
+static void render_skips_leading_space(struct kunit *test)
+{
+    show_text(" A B", NULL);
+
+    expect_glyph(test, 0, 0, 'A');
+    expect_glyph(test, 0, 2 * CHARACTER_SPACE, 'B');
+    expect_panel_matches(test);
+}
+
+static void render_wraps_lines(struct kunit *test)
+{
+    char line[GLYPHS_PER_LINE + 3];
+
+    memset(line, 'W', GLYPHS_PER_LINE);
+    line[GLYPHS_PER_LINE] = ' ';
+    line[GLYPHS_PER_LINE + 1] = 'X';
+    line[GLYPHS_PER_LINE + 2] = '\0';
+
+    show_text(line, NULL);
+
+    // The space lands on the start of the next line and is skipped there
+    expect_glyph(test, 0, (GLYPHS_PER_LINE - 1) * CHARACTER_SPACE, 'W');
+    expect_glyph(test, 1, 0, 'X');
+    expect_panel_matches(test);
+}
+
+static void render_newlines(struct kunit *test)
+{
+    show_text("1\n2\n3\n4\n5\n6\n7\n8\n9", NULL);
+
+    expect_glyph(test, 1, 0, '2');
+    expect_glyph(test, SCREEN_PAGES - 1, 0, '8');
+    KUNIT_EXPECT_EQ(test, y, (int)SCREEN_PAGES);
+    expect_panel_matches(test);
+}
+
+// A malformed command buffer draws nothing, a valid one draws all of it and asks for one commit
+static void render_command_buffer(struct kunit *test)
+{
+    static const u8 truncated[] = {LCD_DRAW_VERSION, LCD_DRAW_RECT, 0, 8, 4, 8, 1, LCD_DRAW_TEXT, 0, 0, 1, 5, 'H'};
+    static const u8 commands[] = {LCD_DRAW_VERSION, LCD_DRAW_CLEAR, 0, 0, 128, 64,
+                                  LCD_DRAW_TEXT, 0, 0, 1, 2, 'H', 'i',
+                                  LCD_DRAW_RECT, 0, 8, 4, 8, 1,
+                                  LCD_DRAW_INVERT, 0, 8, 2, 8,
+                                  LCD_DRAW_COMMIT};
+    int result;
+
+    show_text("", NULL);
+
+    mutex_lock(&frame_mutex);
+    KUNIT_EXPECT_EQ(test, run_draw(base_layer, truncated, sizeof(truncated)), -EINVAL);
+    KUNIT_EXPECT_EQ(test, base_layer[SCREEN_WIDTH + 2], (char)0x00);
+
+    result = run_draw(base_layer, commands, sizeof(commands));
+    mutex_unlock(&frame_mutex);
+
+    mutex_lock(&lcd_mutex);
+    flush_screen();
+    mutex_unlock(&lcd_mutex);
+
+    KUNIT_EXPECT_EQ(test, result, 1);
+    KUNIT_EXPECT_EQ(test, memcmp(test_panel.gram, golden_hi, sizeof(golden_hi)), 0);
+    KUNIT_EXPECT_EQ(test, test_panel.gram[GRAM_WIDTH + 1], (unsigned char)0x00);
+    KUNIT_EXPECT_EQ(test, test_panel.gram[GRAM_WIDTH + 2], (unsigned char)0xFF);
+    expect_panel_matches(test);
+}
+
+// Five lines scroll the fifth into view with the start line, the first is never drawn at all
+static void console_scrolls_start_line(struct kunit *test)
+{
+    reset_console();
+    show_console("one\ntwo\nthree\nfour\nfive\n");
+
+    KUNIT_EXPECT_EQ(test, test_panel.start_line, (unsigned char)8);
+    expect_glyph(test, 1, 0, 't');
+    expect_glyph(test, 4, 0, 'f');
+    KUNIT_EXPECT_EQ(test, test_panel.gram[0], (unsigned char)0x00);
+    expect_panel_matches(test);
+
+    mutex_lock(&lcd_mutex);
+    write_start_line(0);
+    mutex_unlock(&lcd_mutex);
+}
+
+// A display write in between console output would land on page 0, which the scrolled panel no
+// longer shows on top, so it is refused and the console lines stay as they are
+static void console_refuses_display(struct kunit *test)
+{
+    static const char text[] = "Hi";
+
+    reset_console();
+    show_console("one\ntwo\nthree\n");
+
+    enable_console = true;
+    KUNIT_EXPECT_EQ(test, store_display_lcd(NULL, text, strlen(text)), (ssize_t)-EBUSY);
+    enable_console = false;
+
+    show_console("four\nfive\n");
+
+    KUNIT_EXPECT_EQ(test, test_panel.start_line, (unsigned char)8);
+    expect_glyph(test, 1, 0, 't');
+    expect_glyph(test, 4, 0, 'f');
+    KUNIT_EXPECT_EQ(test, test_panel.gram[0], (unsigned char)0x00);
+    expect_panel_matches(test);
+
+    mutex_lock(&lcd_mutex);
+    write_start_line(0);
+    mutex_unlock(&lcd_mutex);
+}
+#pragma endregion
+
+#pragma region bus_budgets
+static void budget_single_character(struct kunit *test)
+{
+    u64 transactions;
+    u64 bytes;
+
+    show_text("Hello", NULL);
+    bytes = show_text("Hellp", &transactions);
+
+    kunit_info(test, "single character change: %llu bytes in %llu transactions", bytes, transactions);
+    KUNIT_EXPECT_LE(test, bytes, SINGLE_CHARACTER_BYTES);
+    KUNIT_EXPECT_LE(test, transactions, SINGLE_CHARACTER_TRANSACTIONS);
+    expect_panel_matches(test);
+}
+
+static void budget_full_screen(struct kunit *test)
+{
+    char text[VISIBLE_PAGES * GLYPHS_PER_LINE + 1];
+    u64 transactions;
+    u64 bytes;
+
+    memset(text, '#', sizeof(text) - 1);
+    text[sizeof(text) - 1] = '\0';
+
+    bytes = show_text(text, &transactions);
+
+    kunit_info(test, "full screen text: %llu bytes in %llu transactions", bytes, transactions);
+    KUNIT_EXPECT_LE(test, bytes, FULL_SCREEN_BYTES);
+    KUNIT_EXPECT_LE(test, transactions, FULL_SCREEN_TRANSACTIONS);
+    expect_panel_matches(test);
+
+    bytes = show_text("", &transactions);
+
+    kunit_info(test, "clear: %llu bytes in %llu transactions", bytes, transactions);
+    KUNIT_EXPECT_LE(test, bytes, CLEAR_BYTES);
+    expect_panel_matches(test);
+}
+
+static void budget_identical_frame(struct kunit *test)
+{
+    u64 transactions;
+
+    show_text("Higher or Lower?", NULL);
+
+    KUNIT_EXPECT_EQ(test, show_text("Higher or Lower?", &transactions), 0ULL);
+    KUNIT_EXPECT_EQ(test, transactions, 0ULL);
+}
+
+// Frames committed while the previous one is still going out reach the panel as one
+static void coalesced_commits(struct kunit *test)
+{
+    u64 coalesced = atomic64_read(&statistics.frames_coalesced);
+    u64 sequence;
+
+    mutex_lock(&frame_mutex);
+    reset_screen();
+    render_text("1", 1);
+    atomic64_inc(&committed_seq);
+    render_text("2", 1);
+    sequence = atomic64_inc_return(&committed_seq);
+    mutex_unlock(&frame_mutex);
+
+    mutex_lock(&lcd_mutex);
+    flush_screen();
+    mutex_unlock(&lcd_mutex);
+
+    KUNIT_EXPECT_EQ(test, (u64)atomic64_read(&flushed_seq), sequence);
+    KUNIT_EXPECT_EQ(test, (u64)atomic64_read(&statistics.frames_coalesced) - coalesced, 1ULL);
+    expect_glyph(test, 0, CHARACTER_SPACE, '2');
+    expect_panel_matches(test);
+}
+
+// Small transfers split the data, the frame on the panel has to come out the same
+static void chunked_transfers(struct kunit *test)
+{
+    u64 transactions;
+
+    max_transfer = MIN_TRANSFER_SIZE;
+    show_text("Current card is 7.\nHigher or Lower?", &transactions);
+
+    KUNIT_EXPECT_GE(test, transactions, 2ULL);
+    expect_panel_matches(test);
+}
+#pragma endregion
+
+#pragma region benchmarks
+static void benchmark_render(struct kunit *test)
+{
+    char text[VISIBLE_PAGES * GLYPHS_PER_LINE + 1];
+    ktime_t start;
+    u64 elapsed_ns;
+    size_t page;
+    int i;
+
+    memset(text, 'M', sizeof(text) - 1);
+    text[sizeof(text) - 1] = '\0';
+
+    mutex_lock(&frame_mutex);
+    start = ktime_get();
+    for (i = 0; i < BENCHMARK_ITERATIONS; i++)
+    {
+        reset_cursor();
+        render_text(text, sizeof(text) - 1);
+    }
+    elapsed_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+    for (page = 0; page < SCREEN_PAGES; page++)
+    {
+        bitmap_zero(damaged_columns[page], SCREEN_WIDTH);
+    }
+    mutex_unlock(&frame_mutex);
+
+    elapsed_ns = div_u64(elapsed_ns, BENCHMARK_ITERATIONS * (sizeof(text) - 1));
+    kunit_info(test, "render: %llu ns per character", elapsed_ns);
+    KUNIT_EXPECT_LE(test, elapsed_ns, RENDER_NS_PER_CHARACTER);
+}
+
+// One glyph on every visible page, the planner has to weigh separate windows against merging them
+static void benchmark_plan(struct kunit *test)
+{
+    static struct flush_plan plan;
+    static struct flush_plan rows;
+    ktime_t start;
+    u64 elapsed_ns;
+    size_t page;
+    int i;
+
+    mutex_lock(&lcd_mutex);
+    for (page = 0; page < VISIBLE_PAGES; page++)
+    {
+        mark_dirty(page, page * 3 * CHARACTER_SPACE, (page * 3 * CHARACTER_SPACE) + CHARACTER_BYTES - 1);
+    }
+
+    start = ktime_get();
+    for (i = 0; i < BENCHMARK_ITERATIONS; i++)
+    {
+        plan_flush(&plan, &rows);
+    }
+    elapsed_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+    for (page = 0; page < SCREEN_PAGES; page++)
+    {
+        bitmap_zero(dirty_columns[page], SCREEN_WIDTH);
+    }
+    mutex_unlock(&lcd_mutex);
+
+    elapsed_ns = div_u64(elapsed_ns, BENCHMARK_ITERATIONS);
+    kunit_info(test, "plan: %llu ns for %zu windows, %zu planned bytes", elapsed_ns, plan.window_count, plan.cost);
+    KUNIT_EXPECT_LE(test, elapsed_ns, PLAN_NS);
+}
+#pragma endregion
+
+static struct kunit_case lcd_test_cases[] = {
+    KUNIT_CASE(render_golden_frame),
+    KUNIT_CASE(render_skips_leading_space),
+    KUNIT_CASE(render_wraps_lines),
+    KUNIT_CASE(render_newlines),
+    KUNIT_CASE(render_command_buffer),
+    KUNIT_CASE(console_scrolls_start_line),
+    KUNIT_CASE(console_refuses_display),
+    KUNIT_CASE(budget_single_character),
+    KUNIT_CASE(budget_full_screen),
+    KUNIT_CASE(budget_identical_frame),
+    KUNIT_CASE(chunked_transfers),
+    KUNIT_CASE(coalesced_commits),
+    KUNIT_CASE(benchmark_render),
+    KUNIT_CASE(benchmark_plan),
+    {}};
+
+static struct kunit_suite lcd_test_suite = {
+    .name = "eindopdracht",
+    .init = lcd_test_init,
+    .exit = lcd_test_exit,
+    .test_cases = lcd_test_cases,
+};
+
+kunit_test_suite(lcd_test_suite);
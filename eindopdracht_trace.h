@@ -0,0 +1,115 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM eindopdracht
+
+#if !defined(_EINDOPDRACHT_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _EINDOPDRACHT_TRACE_H
+
+#include <linux/tracepoint.h>
+
+TRACE_EVENT(lcd_display_write,
+            TP_PROTO(const char *interface, size_t bytes, pid_t pid),
+            TP_ARGS(interface, bytes, pid),
+            TP_STRUCT__entry(
+                __string(interface, interface)
+                __field(size_t, bytes)
+                __field(pid_t, pid)),
+            TP_fast_assign(
+                __assign_str(interface, interface);
+                __entry->bytes = bytes;
+                __entry->pid = pid;),
+            TP_printk("interface=%s bytes=%zu pid=%d", __get_str(interface), __entry->bytes, __entry->pid));
+
+TRACE_EVENT(lcd_render_done,
+            TP_PROTO(size_t glyphs, size_t first_page, size_t last_page, size_t first_column, size_t last_column),
+            TP_ARGS(glyphs, first_page, last_page, first_column, last_column),
+            TP_STRUCT__entry(
+                __field(size_t, glyphs)
+                __field(size_t, first_page)
+                __field(size_t, last_page)
+                __field(size_t, first_column)
+                __field(size_t, last_column)),
+            TP_fast_assign(
+                __entry->glyphs = glyphs;
+                __entry->first_page = first_page;
+                __entry->last_page = last_page;
+                __entry->first_column = first_column;
+                __entry->last_column = last_column;),
+            TP_printk("glyphs=%zu damage=pages %zu-%zu columns %zu-%zu", __entry->glyphs,
+                      __entry->first_page, __entry->last_page, __entry->first_column, __entry->last_column));
+
+TRACE_EVENT(lcd_flush_start,
+            TP_PROTO(size_t windows, size_t cost, char memory_mode, size_t first_page, size_t last_page,
+                     size_t first_column, size_t last_column),
+            TP_ARGS(windows, cost, memory_mode, first_page, last_page, first_column, last_column),
+            TP_STRUCT__entry(
+                __field(size_t, windows)
+                __field(size_t, cost)
+                __field(char, memory_mode)
+                __field(size_t, first_page)
+                __field(size_t, last_page)
+                __field(size_t, first_column)
+                __field(size_t, last_column)),
+            TP_fast_assign(
+                __entry->windows = windows;
+                __entry->cost = cost;
+                __entry->memory_mode = memory_mode;
+                __entry->first_page = first_page;
+                __entry->last_page = last_page;
+                __entry->first_column = first_column;
+                __entry->last_column = last_column;),
+            TP_printk("windows=%zu planned_bytes=%zu mode=%d first_window=pages %zu-%zu columns %zu-%zu",
+                      __entry->windows, __entry->cost, __entry->memory_mode, __entry->first_page,
+                      __entry->last_page, __entry->first_column, __entry->last_column));
+
+TRACE_EVENT(lcd_flush_end,
+            TP_PROTO(u64 bytes, u64 transactions, int result),
+            TP_ARGS(bytes, transactions, result),
+            TP_STRUCT__entry(
+                __field(u64, bytes)
+                __field(u64, transactions)
+                __field(int, result)),
+            TP_fast_assign(
+                __entry->bytes = bytes;
+                __entry->transactions = transactions;
+                __entry->result = result;),
+            TP_printk("bytes=%llu transactions=%llu result=%d", __entry->bytes, __entry->transactions,
+                      __entry->result));
+
+TRACE_EVENT(lcd_i2c_error,
+            TP_PROTO(size_t bytes, int result),
+            TP_ARGS(bytes, result),
+            TP_STRUCT__entry(
+                __field(size_t, bytes)
+                __field(int, result)),
+            TP_fast_assign(
+                __entry->bytes = bytes;
+                __entry->result = result;),
+            TP_printk("bytes=%zu result=%d", __entry->bytes, __entry->result));
+
+TRACE_EVENT(lcd_frame_dropped,
+            TP_PROTO(const char *reason),
+            TP_ARGS(reason),
+            TP_STRUCT__entry(
+                __string(reason, reason)),
+            TP_fast_assign(
+                __assign_str(reason, reason);),
+            TP_printk("reason=%s", __get_str(reason)));
+
+TRACE_EVENT(lcd_pm_transition,
+            TP_PROTO(const char *transition, int result),
+            TP_ARGS(transition, result),
+            TP_STRUCT__entry(
+                __string(transition, transition)
+                __field(int, result)),
+            TP_fast_assign(
+                __assign_str(transition, transition);
+                __entry->result = result;),
+            TP_printk("transition=%s result=%d", __get_str(transition), __entry->result));
+
+#endif
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE eindopdracht_trace
+#include <trace/define_trace.h>
@@ -0,0 +1,383 @@
+// Drives the lcd driver's sysfs interface with a fixed workload and reports how long writes take
+// to queue their frame, how many frames reached the panel and how many were coalesced on the way.
+// A write returns before its frame is on the bus, so the bus time shows in frames/s, measured up
+// to the point every frame was flushed.
+//
+//   make lcd_bench
+//   ./lcd_bench [-w field|full|burst|fps] [-n writes] [-t writers] [-f fps]
+//               [-d driver directory] [-p device directory] [-s debugfs statistics]
+//
+// field  a score that changes one character per write
+// full   a screen full of text that changes completely every write
+// burst  -t writers writing their own text back to back
+// fps    paced writes at -f frames per second, reports what the driver kept up with
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "lcd_statistics.h"
+
+/***********************************************************/
+/************************ DEFINES **************************/
+/***********************************************************/
+#define DEFAULT_DRIVER_DIRECTORY "/sys/bus/i2c/drivers/lcd-driver"
+#define DEFAULT_STATISTICS "/sys/kernel/debug/lcd-driver/2-003c/statistics"
+#define DEFAULT_WRITES 500
+#define DEFAULT_WRITERS 4
+#define DEFAULT_FPS 30
+#define MAX_WRITERS 64
+#define MAX_PATH 256
+#define SCREEN_TEXT 84 // four lines of 21 characters
+#define NSEC_PER_SEC 1000000000LL
+
+/***********************************************************/
+/************************* TYPES ***************************/
+/***********************************************************/
+
+enum workload
+{
+    FIELD,
+    FULL,
+    BURST,
+    FPS
+};
+
+struct writer
+{
+    pthread_t thread;
+    int id;
+    long long *latencies; // ns per write
+    int count;
+    int failures;
+};
+
+/***********************************************************/
+/****************** FUNCTION PROTOTYPES ********************/
+/***********************************************************/
+
+static long long now_ns(void);
+static int write_attribute(const char *, const char *);
+static void compose(int, int, char *, size_t);
+static void *run_writer(void *);
+static int compare_latency(const void *, const void *);
+static void report(struct writer *, int, long long, const struct driver_statistics *,
+                   const struct driver_statistics *, int);
+
+/***********************************************************/
+/******************** GLOBAL VARIABLES *********************/
+/***********************************************************/
+static enum workload workload = FIELD;
+static int writes = DEFAULT_WRITES;
+static int writers = 0;
+static int fps = DEFAULT_FPS;
+static const char *driver_directory = DEFAULT_DRIVER_DIRECTORY;
+static const char *device_directory = DEFAULT_DEVICE_DIRECTORY;
+static const char *statistics_path = DEFAULT_STATISTICS;
+static char display_path[MAX_PATH];
+
+/***********************************************************/
+/****************** FUNCTION DEFINITIONS *******************/
+/***********************************************************/
+
+int main(int argc, char **argv)
+{
+    static struct writer writer[MAX_WRITERS];
+    struct driver_statistics before;
+    struct driver_statistics after;
+    char enable_path[MAX_PATH];
+    int have_statistics;
+    long long start;
+    long long elapsed;
+    int i;
+
+    for (i = 1; i < argc; i++)
+    {
+        if (i + 1 >= argc)
+        {
+            goto usage;
+        }
+
+        if (strcmp(argv[i], "-w") == 0)
+        {
+            i++;
+            if (strcmp(argv[i], "field") == 0)
+            {
+                workload = FIELD;
+            }
+            else if (strcmp(argv[i], "full") == 0)
+            {
+                workload = FULL;
+            }
+            else if (strcmp(argv[i], "burst") == 0)
+            {
+                workload = BURST;
+            }
+            else if (strcmp(argv[i], "fps") == 0)
+            {
+                workload = FPS;
+            }
+            else
+            {
+                goto usage;
+            }
+        }
+        else if (strcmp(argv[i], "-n") == 0)
+        {
+            writes = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-t") == 0)
+        {
+            writers = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-f") == 0)
+        {
+            fps = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-d") == 0)
+        {
+            driver_directory = argv[++i];
+        }
+        else if (strcmp(argv[i], "-p") == 0)
+        {
+            device_directory = argv[++i];
+        }
+        else if (strcmp(argv[i], "-s") == 0)
+        {
+            statistics_path = argv[++i];
+        }
+        else
+        {
+            goto usage;
+        }
+    }
+
+    if (workload != BURST)
+    {
+        writers = 1;
+    }
+    else if (writers == 0)
+    {
+        writers = DEFAULT_WRITERS;
+    }
+
+    if (writes <= 0 || writers <= 0 || writers > MAX_WRITERS || fps <= 0)
+    {
+        goto usage;
+    }
+
+    snprintf(display_path, sizeof(display_path), "%s/display", driver_directory);
+    snprintf(enable_path, sizeof(enable_path), "%s/enable", driver_directory);
+
+    if (write_attribute(enable_path, "1") < 0)
+    {
+        perror(enable_path);
+        return EXIT_FAILURE;
+    }
+
+    have_statistics = read_statistics(statistics_path, &before) == 0;
+
+    start = now_ns();
+    for (i = 0; i < writers; i++)
+    {
+        writer[i].id = i;
+        writer[i].latencies = calloc(writes, sizeof(long long));
+        if (writer[i].latencies == NULL || pthread_create(&writer[i].thread, NULL, run_writer, &writer[i]) != 0)
+        {
+            fprintf(stderr, "could not start writer %d\n", i);
+            return EXIT_FAILURE;
+        }
+    }
+
+    for (i = 0; i < writers; i++)
+    {
+        pthread_join(writer[i].thread, NULL);
+    }
+
+    if (wait_for_flush(device_directory) < 0)
+    {
+        fprintf(stderr, "frames did not reach the panel, see %s\n", device_directory);
+    }
+    elapsed = now_ns() - start;
+
+    have_statistics = have_statistics && read_statistics(statistics_path, &after) == 0;
+    report(writer, writers, elapsed, &before, &after, have_statistics);
+
+    for (i = 0; i < writers; i++)
+    {
+        free(writer[i].latencies);
+    }
+
+    return EXIT_SUCCESS;
+
+usage:
+    fprintf(stderr, "usage: %s [-w field|full|burst|fps] [-n writes] [-t writers] [-f fps] "
+                    "[-d driver directory] [-p device directory] [-s debugfs statistics]\n",
+            argv[0]);
+    return EXIT_FAILURE;
+}
+
+static long long now_ns(void)
+{
+    struct timespec time;
+
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (time.tv_sec * NSEC_PER_SEC) + time.tv_nsec;
+}
+
+static int write_attribute(const char *path, const char *value)
+{
+    int fd = open(path, O_WRONLY);
+    ssize_t result;
+
+    if (fd < 0)
+    {
+        return -1;
+    }
+
+    result = write(fd, value, strlen(value));
+    close(fd);
+
+    return result < 0 ? -1 : 0;
+}
+
+static void compose(int id, int sequence, char *text, size_t size)
+{
+    size_t length;
+
+    switch (workload)
+    {
+    case FULL:
+        for (length = 0; length < SCREEN_TEXT && length + 1 < size; length++)
+        {
+            text[length] = (char)('!' + ((sequence + length) % ('~' - '!' + 1)));
+        }
+        text[length] = '\0';
+        break;
+    case BURST:
+        snprintf(text, size, "Writer %d\nUpdate %d", id, sequence);
+        break;
+    default:
+        snprintf(text, size, "Score: %d", sequence % 10);
+        break;
+    }
+}
+
+static void *run_writer(void *argument)
+{
+    struct writer *writer = argument;
+    char text[SCREEN_TEXT + 1];
+    long long period = NSEC_PER_SEC / fps;
+    long long next = now_ns();
+    long long start;
+    struct timespec deadline;
+    int fd = open(display_path, O_WRONLY);
+    int i;
+
+    if (fd < 0)
+    {
+        perror(display_path);
+        return NULL;
+    }
+
+    for (i = 0; i < writes; i++)
+    {
+        compose(writer->id, i, text, sizeof(text));
+
+        start = now_ns();
+        if (pwrite(fd, text, strlen(text), 0) < 0)
+        {
+            writer->failures++;
+            continue;
+        }
+        writer->latencies[writer->count++] = now_ns() - start;
+
+        if (workload == FPS)
+        {
+            next += period;
+            deadline.tv_sec = next / NSEC_PER_SEC;
+            deadline.tv_nsec = next % NSEC_PER_SEC;
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR)
+            {
+            }
+        }
+    }
+
+    close(fd);
+    return NULL;
+}
+
+static int compare_latency(const void *a, const void *b)
+{
+    long long left = *(const long long *)a;
+    long long right = *(const long long *)b;
+
+    return (left > right) - (left < right);
+}
+
+static void report(struct writer *writer, int count, long long elapsed, const struct driver_statistics *before,
+                   const struct driver_statistics *after, int have_statistics)
+{
+    long long *latencies;
+    long long frames;
+    long long coalesced;
+    long long total_writes;
+    int samples = 0;
+    int failures = 0;
+    int i;
+
+    for (i = 0; i < count; i++)
+    {
+        samples += writer[i].count;
+        failures += writer[i].failures;
+    }
+
+    latencies = malloc((samples + 1) * sizeof(long long));
+    if (latencies == NULL)
+    {
+        return;
+    }
+
+    samples = 0;
+    for (i = 0; i < count; i++)
+    {
+        memcpy(latencies + samples, writer[i].latencies, writer[i].count * sizeof(long long));
+        samples += writer[i].count;
+    }
+
+    printf("writers: %d writes: %d failed: %d elapsed: %.3f s\n", count, samples, failures, elapsed / 1e9);
+
+    if (samples > 0)
+    {
+        qsort(latencies, samples, sizeof(long long), compare_latency);
+        printf("queue latency p50: %lld us p99: %lld us max: %lld us\n", latencies[samples / 2] / 1000,
+               latencies[(samples * 99) / 100] / 1000, latencies[samples - 1] / 1000);
+        printf("writes/s: %.1f\n", samples * 1e9 / elapsed);
+    }
+
+    if (have_statistics)
+    {
+        frames = after->frames_committed - before->frames_committed;
+        coalesced = after->frames_coalesced - before->frames_coalesced;
+        total_writes = after->writes - before->writes;
+
+        printf("frames/s: %.1f (%lld committed, %lld identical)\n", frames * 1e9 / elapsed, frames,
+               after->frames_identical - before->frames_identical);
+        printf("coalescing ratio: %.3f (%lld of %lld writes)\n",
+               total_writes > 0 ? (double)coalesced / total_writes : 0.0, coalesced, total_writes);
+        printf("bytes/frame: %.1f\n", frames > 0 ? (double)(after->bytes - before->bytes) / frames : 0.0);
+    }
+    else
+    {
+        printf("no driver statistics at %s, frames/s and coalescing not reported\n", statistics_path);
+    }
+
+    free(latencies);
+}
@@ -0,0 +1,41 @@
+#ifndef LCD_CAPTURE_H
+#define LCD_CAPTURE_H
+
+// Capture log of the requests made to the lcd driver, written by the driver (debugfs capture and
+// capture_log) and read back by lcd_replay.
+//
+// The log starts with CAPTURE_MAGIC, followed by one record per request:
+//   u32 little endian microseconds since the previous request (0 for the first)
+//   u8  interface, enum capture_interface
+//   u16 little endian payload length
+//   payload, exactly as written to the interface. Frame requests put the u16 little endian
+//   offset of the write in front of it.
+
+/***********************************************************/
+/************************ DEFINES **************************/
+/***********************************************************/
+#define CAPTURE_MAGIC "LCD1"
+#define CAPTURE_MAGIC_BYTES 4
+#define CAPTURE_HEADER_BYTES 7
+#define CAPTURE_OFFSET_BYTES 2
+#define CAPTURE_MAX_PAYLOAD 0xFFFF
+
+/***********************************************************/
+/************************* TYPES ***************************/
+/***********************************************************/
+
+enum capture_interface
+{
+    CAPTURE_DISPLAY,
+    CAPTURE_ENABLE,
+    CAPTURE_CONTRAST,
+    CAPTURE_FRAME,
+    CAPTURE_DISPLAY_AT,
+    CAPTURE_REGION,
+    CAPTURE_REGION_TEXT,
+    CAPTURE_OVERLAY,
+    CAPTURE_DRAW,
+    CAPTURE_INTERFACES
+};
+
+#endif
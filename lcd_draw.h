@@ -0,0 +1,47 @@
+#ifndef LCD_DRAW_H
+#define LCD_DRAW_H
+
+// Command buffer that draws a whole frame in one request, written to the draw attribute (the base
+// layer) or passed to LCD_DRAW on /dev/lcd (the file's layer).
+//
+// A buffer is the u8 LCD_DRAW_VERSION followed by commands, each a u8 opcode and its u8 arguments.
+// Coordinates are pixels from the top left of the GRAM (128 x 64, the panel shows the top 32 rows),
+// whatever falls outside is clipped. The driver checks the whole buffer before it draws, so a
+// malformed one fails with EINVAL and leaves the frame as it was.
+//
+//   LCD_DRAW_CLEAR   x y width height
+//   LCD_DRAW_TEXT    x y scale length text   the 8 pixel font pixel doubled scale (1-4) times, one
+//                                            line, characters outside ' '-'~' are skipped
+//   LCD_DRAW_LINE    x0 y0 x1 y1
+//   LCD_DRAW_RECT    x y width height fill   an outline, or filled when fill is 1
+//   LCD_DRAW_BLIT    x y width height bits   height rows of (width + 7) / 8 bytes, most significant
+//                                            bit first, set bits set the pixel and clear bits clear it
+//   LCD_DRAW_INVERT  x y width height
+//   LCD_DRAW_COMMIT
+//
+// A buffer with a commit goes out as one frame once all of it is drawn, without one it waits for
+// the next commit.
+
+/***********************************************************/
+/************************ DEFINES **************************/
+/***********************************************************/
+#define LCD_DRAW_VERSION 1
+#define LCD_DRAW_MAX_BYTES 4096
+
+/***********************************************************/
+/************************* TYPES ***************************/
+/***********************************************************/
+
+enum lcd_draw_opcode
+{
+    LCD_DRAW_CLEAR = 1,
+    LCD_DRAW_TEXT,
+    LCD_DRAW_LINE,
+    LCD_DRAW_RECT,
+    LCD_DRAW_BLIT,
+    LCD_DRAW_INVERT,
+    LCD_DRAW_COMMIT,
+    LCD_DRAW_OPCODES
+};
+
+#endif
@@ -0,0 +1,96 @@
+#ifndef LCD_IOCTL_H
+#define LCD_IOCTL_H
+
+// Interface of the lcd character device (/dev/lcd), shared by the driver and its clients.
+//
+// Every open file is a layer the size of the GRAM, in the same page layout as the frame attribute:
+// byte column + 128 * page, bit 0 the top row of the page. write() and pwrite() fill the layer's
+// pixels, the ioctls below place it in the stack. Where a layer's mask is set its pixels hide
+// everything below it, where it is clear the layers below show through. The sysfs interfaces draw
+// the bottom of the stack.
+//
+// Commits through a file with LCD_PRIORITY_HIGH, and overlay attribute writes, interrupt a flush
+// in progress at its next transfer: their area reaches the panel first, the rest of the frame
+// after it.
+
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+#include "lcd_draw.h"
+
+/***********************************************************/
+/************************ DEFINES **************************/
+/***********************************************************/
+#define LCD_DEVICE "/dev/lcd"
+#define LCD_FRAME_BYTES 1024
+
+#define LCD_LAYER_VISIBLE 0x1
+
+#define LCD_PRIORITY_NORMAL 0
+#define LCD_PRIORITY_HIGH 1
+
+#define LCD_IOCTL_MAGIC 'L'
+#define LCD_GET_LAYER _IOR(LCD_IOCTL_MAGIC, 0, struct lcd_layer_info)
+#define LCD_SET_LAYER _IOW(LCD_IOCTL_MAGIC, 1, struct lcd_layer_info)
+#define LCD_SET_MASK _IOW(LCD_IOCTL_MAGIC, 2, struct lcd_layer_mask)
+#define LCD_SHOW_TIMED _IOW(LCD_IOCTL_MAGIC, 3, __u32) // milliseconds, then the layer hides itself
+#define LCD_GET_SEQUENCE _IOR(LCD_IOCTL_MAGIC, 4, struct lcd_sequence)
+#define LCD_QUEUE_FRAME _IOW(LCD_IOCTL_MAGIC, 5, struct lcd_timed_frame)
+#define LCD_GET_PRESENTATION _IOR(LCD_IOCTL_MAGIC, 6, struct lcd_presentation)
+#define LCD_SET_PRIORITY _IOW(LCD_IOCTL_MAGIC, 7, __u32) // LCD_PRIORITY_*, for every later commit
+#define LCD_DRAW _IOW(LCD_IOCTL_MAGIC, 8, struct lcd_draw_buffer)
+
+/***********************************************************/
+/************************* TYPES ***************************/
+/***********************************************************/
+
+// Higher z is drawn on top, layers with the same z stack in the order they were placed there.
+// A new layer has z 0, a fully set mask and is hidden until LCD_SET_LAYER shows it.
+struct lcd_layer_info
+{
+    __s32 z;
+    __u32 flags; // LCD_LAYER_*
+};
+
+struct lcd_layer_mask
+{
+    __u8 bits[LCD_FRAME_BYTES]; // same layout as the pixels
+};
+
+// Writes return once the frame is committed, the transfer runs behind them. Frames are numbered
+// from 1 in commit order across all clients and reach the panel in that order, so a frame is on
+// the panel once flushed >= its number. poll() reports POLLOUT at that point.
+struct lcd_sequence
+{
+    __u64 committed; // last frame committed through this file
+    __u64 flushed;   // last frame on the panel
+};
+
+// Replaces the layer's pixels at target_ns (CLOCK_MONOTONIC). The driver starts the transfer early
+// enough to finish at the target and drops a frame it can no longer get there in time. Up to eight
+// frames per file wait in the queue, more fail with EBUSY.
+struct lcd_timed_frame
+{
+    __u64 target_ns;
+    __u8 pixels[LCD_FRAME_BYTES];
+};
+
+// The last frame presented through this file and what happened to the queued ones so far
+struct lcd_presentation
+{
+    __u64 target_ns;
+    __u64 actual_ns; // when the transfer finished
+    __u64 presented;
+    __u64 dropped; // would have landed late
+};
+
+// A command buffer as described in lcd_draw.h, drawn into the layer. The commit only sends a
+// frame while the layer is visible.
+struct lcd_draw_buffer
+{
+    __u64 commands; // user pointer
+    __u32 size;     // at most LCD_DRAW_MAX_BYTES
+    __u32 reserved;
+};
+
+#endif
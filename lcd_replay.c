@@ -0,0 +1,358 @@
+// Replays a capture log (debugfs capture_log, see lcd_capture.h) against the lcd driver and reports
+// what it cost on the bus once every replayed frame reached the panel.
+//
+//   make lcd_replay
+//   ./lcd_replay [-r] [-w] [-b max bytes] [-t max transactions] [-d driver directory]
+//                [-p device directory] [-f frame attribute] [-s debugfs statistics] capture.log
+//
+// -r keeps the original timing between requests, without it the log is replayed back to back.
+// -w waits for every request to reach the panel before sending the next. Without it the driver
+// coalesces whatever arrives while it flushes, which depends on timing. With it the numbers are
+// deterministic against the ssd1306_virtual panel, so a driver change can be gated on not
+// sending more than the previous one did.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "lcd_capture.h"
+#include "lcd_statistics.h"
+
+/***********************************************************/
+/************************ DEFINES **************************/
+/***********************************************************/
+#define DEFAULT_DRIVER_DIRECTORY "/sys/bus/i2c/drivers/lcd-driver"
+#define DEFAULT_FRAME "/sys/bus/i2c/drivers/lcd-driver/2-003c/frame"
+#define DEFAULT_STATISTICS "/sys/kernel/debug/lcd-driver/2-003c/statistics"
+#define MAX_PATH 256
+#define NSEC_PER_SEC 1000000000LL
+#define NSEC_PER_USEC 1000LL
+
+/***********************************************************/
+/****************** FUNCTION PROTOTYPES ********************/
+/***********************************************************/
+
+static long long now_ns(void);
+static unsigned char *read_log(const char *, size_t *);
+static int replay(const unsigned char *, size_t);
+
+/***********************************************************/
+/******************** GLOBAL VARIABLES *********************/
+/***********************************************************/
+static const char *const interface_names[CAPTURE_INTERFACES] = {
+    "display",
+    "enable",
+    "contrast",
+    "frame",
+    "display_at",
+    "region",
+    "region_text",
+    "overlay",
+    "draw",
+};
+
+static const char *driver_directory = DEFAULT_DRIVER_DIRECTORY;
+static const char *frame_path = DEFAULT_FRAME;
+static const char *statistics_path = DEFAULT_STATISTICS;
+static const char *device_directory = DEFAULT_DEVICE_DIRECTORY;
+static int original_timing = 0;
+static int synchronous = 0;
+static long long requests[CAPTURE_INTERFACES];
+static long long failures = 0;
+
+/***********************************************************/
+/****************** FUNCTION DEFINITIONS *******************/
+/***********************************************************/
+
+int main(int argc, char **argv)
+{
+    const char *log_path = NULL;
+    long long max_bytes = -1;
+    long long max_transactions = -1;
+    struct driver_statistics before;
+    struct driver_statistics after;
+    int have_statistics;
+    unsigned char *log;
+    size_t size;
+    long long start;
+    long long elapsed;
+    int result = EXIT_SUCCESS;
+    int i;
+
+    for (i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-r") == 0)
+        {
+            original_timing = 1;
+        }
+        else if (strcmp(argv[i], "-w") == 0)
+        {
+            synchronous = 1;
+        }
+        else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc)
+        {
+            max_bytes = atoll(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+        {
+            max_transactions = atoll(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc)
+        {
+            driver_directory = argv[++i];
+        }
+        else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc)
+        {
+            device_directory = argv[++i];
+        }
+        else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc)
+        {
+            frame_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+        {
+            statistics_path = argv[++i];
+        }
+        else if (argv[i][0] != '-' && log_path == NULL)
+        {
+            log_path = argv[i];
+        }
+        else
+        {
+            log_path = NULL;
+            break;
+        }
+    }
+
+    if (log_path == NULL)
+    {
+        fprintf(stderr, "usage: %s [-r] [-w] [-b max bytes] [-t max transactions] [-d driver directory] "
+                        "[-p device directory] [-f frame attribute] [-s debugfs statistics] capture.log\n",
+                argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    log = read_log(log_path, &size);
+    if (log == NULL)
+    {
+        return EXIT_FAILURE;
+    }
+
+    have_statistics = read_statistics(statistics_path, &before) == 0;
+
+    start = now_ns();
+    if (replay(log, size) < 0)
+    {
+        free(log);
+        return EXIT_FAILURE;
+    }
+    free(log);
+
+    if (wait_for_flush(device_directory) < 0)
+    {
+        fprintf(stderr, "replayed frames did not reach the panel, see %s\n", device_directory);
+        return EXIT_FAILURE;
+    }
+    elapsed = now_ns() - start;
+
+    printf("requests: %lld display, %lld display_at, %lld region, %lld region_text, %lld overlay, %lld draw, "
+           "%lld enable, %lld contrast, %lld frame, %lld failed\n",
+           requests[CAPTURE_DISPLAY], requests[CAPTURE_DISPLAY_AT], requests[CAPTURE_REGION],
+           requests[CAPTURE_REGION_TEXT], requests[CAPTURE_OVERLAY], requests[CAPTURE_DRAW],
+           requests[CAPTURE_ENABLE], requests[CAPTURE_CONTRAST], requests[CAPTURE_FRAME], failures);
+    printf("elapsed: %.3f s (%s timing%s)\n", elapsed / 1e9, original_timing ? "original" : "fast",
+           synchronous ? ", synchronous" : "");
+
+    if (!have_statistics || read_statistics(statistics_path, &after) < 0)
+    {
+        printf("no driver statistics at %s, bus cost not reported\n", statistics_path);
+        return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    printf("frames_committed: %lld\n", after.frames_committed - before.frames_committed);
+    printf("frames_identical: %lld\n", after.frames_identical - before.frames_identical);
+    printf("bytes: %lld\n", after.bytes - before.bytes);
+    printf("transactions: %lld\n", after.transactions - before.transactions);
+
+    if (max_bytes >= 0 && after.bytes - before.bytes > max_bytes)
+    {
+        printf("bytes over budget of %lld\n", max_bytes);
+        result = EXIT_FAILURE;
+    }
+
+    if (max_transactions >= 0 && after.transactions - before.transactions > max_transactions)
+    {
+        printf("transactions over budget of %lld\n", max_transactions);
+        result = EXIT_FAILURE;
+    }
+
+    return failures == 0 ? result : EXIT_FAILURE;
+}
+
+static long long now_ns(void)
+{
+    struct timespec time;
+
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (time.tv_sec * NSEC_PER_SEC) + time.tv_nsec;
+}
+
+static unsigned char *read_log(const char *path, size_t *size)
+{
+    FILE *file = fopen(path, "rb");
+    unsigned char *log = NULL;
+    size_t capacity = 0;
+    size_t read;
+    unsigned char *grown;
+
+    if (file == NULL)
+    {
+        perror(path);
+        return NULL;
+    }
+
+    // debugfs files report no size, so grow while reading
+    *size = 0;
+    do
+    {
+        if (*size == capacity)
+        {
+            capacity = capacity == 0 ? 4096 : capacity * 2;
+            grown = realloc(log, capacity);
+            if (grown == NULL)
+            {
+                free(log);
+                fclose(file);
+                return NULL;
+            }
+            log = grown;
+        }
+
+        read = fread(log + *size, 1, capacity - *size, file);
+        *size += read;
+    } while (read > 0);
+
+    fclose(file);
+
+    if (*size < CAPTURE_MAGIC_BYTES || memcmp(log, CAPTURE_MAGIC, CAPTURE_MAGIC_BYTES) != 0)
+    {
+        fprintf(stderr, "%s is not a capture log\n", path);
+        free(log);
+        return NULL;
+    }
+
+    return log;
+}
+
+static int replay(const unsigned char *log, size_t size)
+{
+    int fd[CAPTURE_INTERFACES];
+    char path[MAX_PATH];
+    size_t offset = CAPTURE_MAGIC_BYTES;
+    long long next = now_ns();
+    struct timespec deadline;
+    unsigned long delta_us;
+    unsigned int interface;
+    size_t length;
+    long offset_in_frame;
+    int result = 0;
+    int i;
+
+    for (i = 0; i < CAPTURE_INTERFACES; i++)
+    {
+        fd[i] = -1;
+    }
+
+    while (result == 0 && offset + CAPTURE_HEADER_BYTES <= size)
+    {
+        delta_us = log[offset] | ((unsigned long)log[offset + 1] << 8) | ((unsigned long)log[offset + 2] << 16) |
+                   ((unsigned long)log[offset + 3] << 24);
+        interface = log[offset + 4];
+        length = log[offset + 5] | ((size_t)log[offset + 6] << 8);
+        offset += CAPTURE_HEADER_BYTES;
+
+        if (interface >= CAPTURE_INTERFACES || offset + length > size)
+        {
+            fprintf(stderr, "capture log is corrupt at byte %zu\n", offset);
+            result = -1;
+            break;
+        }
+
+        if (original_timing)
+        {
+            next += delta_us * NSEC_PER_USEC;
+            deadline.tv_sec = next / NSEC_PER_SEC;
+            deadline.tv_nsec = next % NSEC_PER_SEC;
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR)
+            {
+            }
+        }
+
+        // Opened on first use, a log without frame requests replays on a driver without the attribute
+        if (fd[interface] < 0)
+        {
+            if (interface == CAPTURE_FRAME)
+            {
+                snprintf(path, sizeof(path), "%s", frame_path);
+            }
+            else
+            {
+                snprintf(path, sizeof(path), "%s/%s", driver_directory, interface_names[interface]);
+            }
+
+            fd[interface] = open(path, O_WRONLY);
+            if (fd[interface] < 0)
+            {
+                perror(path);
+                result = -1;
+                break;
+            }
+        }
+
+        offset_in_frame = 0;
+        if (interface == CAPTURE_FRAME)
+        {
+            if (length < CAPTURE_OFFSET_BYTES)
+            {
+                fprintf(stderr, "capture log is corrupt at byte %zu\n", offset);
+                result = -1;
+                break;
+            }
+
+            offset_in_frame = log[offset] | ((long)log[offset + 1] << 8);
+            offset += CAPTURE_OFFSET_BYTES;
+            length -= CAPTURE_OFFSET_BYTES;
+        }
+
+        requests[interface]++;
+        if (pwrite(fd[interface], log + offset, length, offset_in_frame) < 0)
+        {
+            failures++;
+        }
+
+        if (synchronous && wait_for_flush(device_directory) < 0)
+        {
+            fprintf(stderr, "request at byte %zu did not reach the panel, see %s\n", offset, device_directory);
+            result = -1;
+            break;
+        }
+
+        offset += length;
+    }
+
+    for (i = 0; i < CAPTURE_INTERFACES; i++)
+    {
+        if (fd[i] >= 0)
+        {
+            close(fd[i]);
+        }
+    }
+
+    return result;
+}
@@ -0,0 +1,150 @@
+#ifndef LCD_STATISTICS_H
+#define LCD_STATISTICS_H
+
+// What lcd_bench and lcd_replay read back from the driver: the counters of its debugfs statistics
+// file and whether the frames committed so far reached the panel. Host side only.
+
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+/***********************************************************/
+/************************ DEFINES **************************/
+/***********************************************************/
+#define DEFAULT_DEVICE_DIRECTORY "/sys/bus/i2c/drivers/lcd-driver/2-003c"
+#define FLUSH_TIMEOUT_MS 5000 // covers a runtime resume and a full frame at 100 kHz
+#define SEQUENCE_PATH_BYTES 256
+
+/***********************************************************/
+/************************* TYPES ***************************/
+/***********************************************************/
+
+struct driver_statistics
+{
+    long long writes;
+    long long frames_committed;
+    long long frames_coalesced;
+    long long frames_identical;
+    long long bytes;
+    long long transactions;
+};
+
+/***********************************************************/
+/****************** FUNCTION DEFINITIONS *******************/
+/***********************************************************/
+
+// The statistics are "name: value" lines, the histograms after them are skipped
+static inline int read_statistics(const char *path, struct driver_statistics *statistics)
+{
+    FILE *file = fopen(path, "r");
+    char name[64];
+    long long value;
+
+    if (file == NULL)
+    {
+        return -1;
+    }
+
+    memset(statistics, 0, sizeof(*statistics));
+    while (fscanf(file, "%63[^:]: %lld\n", name, &value) == 2)
+    {
+        if (strcmp(name, "writes") == 0)
+        {
+            statistics->writes = value;
+        }
+        else if (strcmp(name, "frames_committed") == 0)
+        {
+            statistics->frames_committed = value;
+        }
+        else if (strcmp(name, "frames_coalesced") == 0)
+        {
+            statistics->frames_coalesced = value;
+        }
+        else if (strcmp(name, "frames_identical") == 0)
+        {
+            statistics->frames_identical = value;
+        }
+        else if (strcmp(name, "bytes") == 0)
+        {
+            statistics->bytes = value;
+        }
+        else if (strcmp(name, "transactions") == 0)
+        {
+            statistics->transactions = value;
+        }
+    }
+
+    fclose(file);
+    return 0;
+}
+
+static inline int read_sequence(int fd, long long *sequence)
+{
+    char buffer[32];
+    ssize_t size = pread(fd, buffer, sizeof(buffer) - 1, 0);
+
+    if (size <= 0)
+    {
+        return -1;
+    }
+
+    buffer[size] = '\0';
+    return sscanf(buffer, "%lld", sequence) == 1 ? 0 : -1;
+}
+
+// Writes return once their frame is committed, the flush worker sends it later. Everything
+// committed so far is on the panel, and in the statistics, once flushed_seq caught up with
+// committed_seq. The driver sysfs_notify()s flushed_seq, which wakes poll() with POLLPRI.
+static inline int wait_for_flush(const char *device_directory)
+{
+    char path[SEQUENCE_PATH_BYTES];
+    struct pollfd watch;
+    long long committed;
+    long long flushed;
+    int result;
+    int fd;
+
+    snprintf(path, sizeof(path), "%s/committed_seq", device_directory);
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return -1;
+    }
+
+    result = read_sequence(fd, &committed);
+    close(fd);
+    if (result < 0)
+    {
+        return -1;
+    }
+
+    snprintf(path, sizeof(path), "%s/flushed_seq", device_directory);
+    watch.fd = open(path, O_RDONLY);
+    watch.events = POLLPRI | POLLERR;
+    if (watch.fd < 0)
+    {
+        return -1;
+    }
+
+    result = -1;
+    while (read_sequence(watch.fd, &flushed) == 0)
+    {
+        if (flushed >= committed)
+        {
+            result = 0;
+            break;
+        }
+
+        if (poll(&watch, 1, FLUSH_TIMEOUT_MS) <= 0)
+        {
+            break;
+        }
+    }
+
+    close(watch.fd);
+    return result;
+}
+
+#endif
@@ -3,7 +3,48 @@ use std::{fs, time::Duration};
 use std::time::{SystemTime, UNIX_EPOCH};
 
 const ENABLE: &str = "/sys/bus/i2c/drivers/lcd-driver/enable";
-const DISPLAY: &str = "/sys/bus/i2c/drivers/lcd-driver/display";
+const DRAW: &str = "/sys/bus/i2c/drivers/lcd-driver/draw";
+
+// Command buffer format, see lcd_draw.h
+const DRAW_VERSION: u8 = 1;
+const DRAW_CLEAR: u8 = 1;
+const DRAW_TEXT: u8 = 2;
+const DRAW_RECT: u8 = 4;
+const DRAW_COMMIT: u8 = 7;
+
+const SCREEN_WIDTH: u8 = 128;
+const SCREEN_HEIGHT: u8 = 32;
+const CHARACTER_SPACE: u8 = 6;
+
+// The whole screen in one write: cleared, drawn and committed as a single frame
+fn draw(commands: &[u8]) -> std::io::Result<()> {
+    let mut buffer = vec![DRAW_VERSION, DRAW_CLEAR, 0, 0, SCREEN_WIDTH, SCREEN_HEIGHT];
+    buffer.extend_from_slice(commands);
+    buffer.push(DRAW_COMMIT);
+    fs::write(DRAW, &buffer)
+}
+
+fn text(commands: &mut Vec<u8>, x: u8, y: u8, scale: u8, text: &str) {
+    commands.extend_from_slice(&[DRAW_TEXT, x, y, scale, text.len() as u8]);
+    commands.extend_from_slice(text.as_bytes());
+}
+
+fn show_message(message: &str) -> std::io::Result<()> {
+    let mut commands = Vec::new();
+    let width = message.len() as u8 * CHARACTER_SPACE;
+
+    text(&mut commands, SCREEN_WIDTH.saturating_sub(width) / 2, 12, 1, message);
+    draw(&commands)
+}
+
+fn show_card(card: &str) -> std::io::Result<()> {
+    let mut commands = vec![DRAW_RECT, 0, 0, 28, SCREEN_HEIGHT, 0];
+
+    text(&mut commands, 2, 8, 2, card);
+    text(&mut commands, 34, 4, 1, "Higher or");
+    text(&mut commands, 34, 18, 1, "Lower? (h/l)");
+    draw(&commands)
+}
 
 fn main() -> std::io::Result<()> {
     fs::write(ENABLE, b"1")?;
@@ -32,14 +73,13 @@ fn main() -> std::io::Result<()> {
             _ => "K".to_string(),
         };
 
-        let message = format!("Current card is {}.\nHigher or Lower?", result);
-        fs::write(DISPLAY, message.as_bytes())?;
+        show_card(&result)?;
 
         let mut input: String = String::new();
         std::io::stdin().read_line(&mut input)?;
 
         if input == "Q\n" || input == "q\n" {
-            fs::write(DISPLAY, b"Thanks for playing!")?;
+            show_message("Thanks for playing!")?;
             std::thread::sleep(Duration::from_secs(1));
             break;
         }
@@ -66,10 +106,10 @@ fn main() -> std::io::Result<()> {
             || (old_number > number && !is_higher.unwrap())
             || (number == old_number)
         {
-            fs::write(DISPLAY, b"Good Guess!")?;
+            show_message("Good Guess!")?;
             std::thread::sleep(Duration::from_secs(1));
         } else {
-            fs::write(DISPLAY, b"Wrong Guess!")?;
+            show_message("Wrong Guess!")?;
             std::thread::sleep(Duration::from_secs(1));
         }
     }
@@ -0,0 +1,59 @@
+#ifndef SSD1306_H
+#define SSD1306_H
+
+// SSD1306 wire protocol, shared by the driver and the host side tools. Only plain C so it builds
+// in the kernel and with -std=c11 -pedantic on the host.
+
+/***********************************************************/
+/************************ DEFINES **************************/
+/***********************************************************/
+#define COMMAND ((char)0x00)
+#define DATA ((char)0x40)
+#define CONTINUATION_BIT ((char)0x80) // Co, one byte follows before the next control byte
+
+#define PUMP_COMMAND ((char)0x8D)
+#define ENABLE_SCREEN_COMMAND ((char)0xAE) // | 1 switches the display on
+#define SET_CLOCK_DIV_COMMAND ((char)0xD5)
+#define SET_MUX_COMMAND ((char)0xA8)
+#define SET_DISPLAY_OFFSET_COMMAND ((char)0xD3)
+#define SET_START_LINE ((char)0x40) // | line, 0 - 63
+#define SET_MEMORY_MODE_COMMAND ((char)0x20)
+#define SEG_NORMAL_COMMAND ((char)0xA0)
+#define SEG_REMAP_COMMAND ((char)0xA1)
+#define SET_COMM_SCAN_NORMAL_COMMAND ((char)0xC0)
+#define SET_COMM_SCAN_COMMAND ((char)0xC8)
+#define SET_COMM_PINS_COMMAND ((char)0xDA)
+#define SET_CONTRAST_COMMAND ((char)0x81)
+#define SET_VCOMM_DETECT_COMMAND ((char)0xDB)
+#define SET_DISPLAY_RESUME_COMMAND ((char)0xA4)
+#define SET_ENTIRE_DISPLAY_ON_COMMAND ((char)0xA5)
+#define SET_NORMAL_DISPLAY ((char)0xA6)
+#define SET_INVERSE_DISPLAY ((char)0xA7)
+#define SET_PRECHARGE_COMMAND ((char)0xD9)
+#define SET_PAGE_ADDRESS_COMMAND ((char)0x22)
+#define SET_COLUMN_START_ADDRESS ((char)0x21)
+#define SET_PAGE_START_COMMAND ((char)0xB0) // | page, page addressing only
+#define SET_LOWER_COLUMN_COMMAND ((char)0x00)
+#define SET_HIGHER_COLUMN_COMMAND ((char)0x10)
+#define RIGHT_SCROLL_COMMAND ((char)0x26)
+#define LEFT_SCROLL_COMMAND ((char)0x27)
+#define VERTICAL_RIGHT_SCROLL_COMMAND ((char)0x29)
+#define VERTICAL_LEFT_SCROLL_COMMAND ((char)0x2A)
+#define DEACTIVATE_SCROLL_COMMAND ((char)0x2E)
+#define ACTIVATE_SCROLL_COMMAND ((char)0x2F)
+#define SET_VERTICAL_SCROLL_AREA_COMMAND ((char)0xA3)
+#define NOP_COMMAND ((char)0xE3)
+
+#define HORIZONTAL_ADDRESSING ((char)0x00)
+#define VERTICAL_ADDRESSING ((char)0x01)
+#define PAGE_ADDRESSING ((char)0x02)
+
+#define GRAM_WIDTH 128
+#define GRAM_PAGES 8
+#define GRAM_ROWS (GRAM_PAGES * 8)
+
+// A recording is a sequence of transactions, each a little endian 16 bit length followed by the
+// bytes that went out on the bus, control byte included
+#define RECORD_HEADER_BYTES 2
+
+#endif
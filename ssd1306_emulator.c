@@ -0,0 +1,162 @@
+// Replays a recording of the driver's bus traffic (debugfs record/recording) into an emulated
+// SSD1306 and dumps what the panel would show as a PBM, together with the bus cost.
+//
+//   make ssd1306_emulator
+//   ./ssd1306_emulator [-g] [-o frame.pbm] [recording]
+//
+// -g dumps the whole 128x64 GRAM instead of the visible rows. Without a recording it reads stdin.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ssd1306_emulator.h"
+
+/***********************************************************/
+/****************** FUNCTION PROTOTYPES ********************/
+/***********************************************************/
+
+static int replay(FILE *, struct ssd1306_emulator *);
+static void write_pbm(FILE *, const struct ssd1306_emulator *, int);
+static void print_statistics(const struct ssd1306_emulator *);
+
+/***********************************************************/
+/****************** FUNCTION DEFINITIONS *******************/
+/***********************************************************/
+
+int main(int argc, char **argv)
+{
+    static struct ssd1306_emulator emulator;
+    const char *recording_path = NULL;
+    const char *image_path = NULL;
+    int dump_gram = 0;
+    FILE *recording = stdin;
+    FILE *image;
+    int result;
+    int i;
+
+    for (i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-g") == 0)
+        {
+            dump_gram = 1;
+        }
+        else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+        {
+            image_path = argv[++i];
+        }
+        else if (argv[i][0] != '-' && recording_path == NULL)
+        {
+            recording_path = argv[i];
+        }
+        else
+        {
+            fprintf(stderr, "usage: %s [-g] [-o image.pbm] [recording]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (recording_path != NULL)
+    {
+        recording = fopen(recording_path, "rb");
+        if (recording == NULL)
+        {
+            perror(recording_path);
+            return EXIT_FAILURE;
+        }
+    }
+
+    ssd1306_emulator_init(&emulator);
+    result = replay(recording, &emulator);
+
+    if (recording != stdin)
+    {
+        fclose(recording);
+    }
+
+    if (result < 0)
+    {
+        fprintf(stderr, "recording ends in the middle of a transaction\n");
+        return EXIT_FAILURE;
+    }
+
+    if (image_path != NULL)
+    {
+        image = fopen(image_path, "w");
+        if (image == NULL)
+        {
+            perror(image_path);
+            return EXIT_FAILURE;
+        }
+
+        write_pbm(image, &emulator, dump_gram);
+        fclose(image);
+    }
+
+    print_statistics(&emulator);
+
+    return emulator.protocol_errors == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static int replay(FILE *recording, struct ssd1306_emulator *emulator)
+{
+    unsigned char header[RECORD_HEADER_BYTES];
+    unsigned char transaction[1 << 16];
+    size_t size;
+
+    while (fread(header, 1, sizeof(header), recording) == sizeof(header))
+    {
+        size = header[0] | ((size_t)header[1] << 8);
+
+        if (fread(transaction, 1, size, recording) != size)
+        {
+            return -1;
+        }
+
+        ssd1306_emulator_transaction(emulator, transaction, size);
+    }
+
+    return feof(recording) ? 0 : -1;
+}
+
+// Plain (P1) PBM so golden frames diff as text, 1 is a lit pixel
+static void write_pbm(FILE *image, const struct ssd1306_emulator *emulator, int dump_gram)
+{
+    size_t rows = dump_gram ? GRAM_ROWS : ssd1306_emulator_rows(emulator);
+    size_t row;
+    size_t column;
+    int pixel;
+
+    fprintf(image, "P1\n%d %zu\n", GRAM_WIDTH, rows);
+
+    for (row = 0; row < rows; row++)
+    {
+        for (column = 0; column < GRAM_WIDTH; column++)
+        {
+            if (dump_gram)
+            {
+                pixel = (emulator->gram[column + (GRAM_WIDTH * (row / 8))] >> (row % 8)) & 1;
+            }
+            else
+            {
+                pixel = ssd1306_emulator_pixel(emulator, row, column);
+            }
+
+            fputc(pixel ? '1' : '0', image);
+        }
+
+        fputc('\n', image);
+    }
+}
+
+static void print_statistics(const struct ssd1306_emulator *emulator)
+{
+    printf("transactions: %llu\n", emulator->transactions);
+    printf("bytes: %llu\n", emulator->bytes);
+    printf("command_bytes: %llu\n", emulator->command_bytes);
+    printf("data_bytes: %llu\n", emulator->data_bytes);
+    printf("protocol_errors: %llu\n", emulator->protocol_errors);
+    printf("display: %s contrast %u start_line %u memory_mode %u scroll %s\n",
+           emulator->display_on ? "on" : "off", emulator->contrast, emulator->start_line, emulator->memory_mode,
+           emulator->scroll.active ? "active" : "off");
+}
@@ -0,0 +1,355 @@
+#ifndef SSD1306_EMULATOR_H
+#define SSD1306_EMULATOR_H
+
+// Decodes the SSD1306 byte stream into a GRAM image the way the controller does. Header only so
+// the host tools and kernel code share one model of the panel.
+
+#ifdef __KERNEL__
+#include <linux/string.h>
+#include <linux/types.h>
+#else
+#include <stddef.h>
+#include <string.h>
+#endif
+
+#include "ssd1306.h"
+
+/***********************************************************/
+/************************* TYPES ***************************/
+/***********************************************************/
+
+struct ssd1306_scroll
+{
+    unsigned char command;
+    unsigned char first_page;
+    unsigned char last_page;
+    unsigned char interval;
+    unsigned char vertical_offset;
+    unsigned char area_top;
+    unsigned char area_rows;
+    unsigned char active;
+};
+
+struct ssd1306_emulator
+{
+    unsigned char gram[GRAM_PAGES * GRAM_WIDTH];
+
+    unsigned char memory_mode;
+    unsigned char first_page;
+    unsigned char last_page;
+    unsigned char first_column;
+    unsigned char last_column;
+    unsigned char page;
+    unsigned char column;
+    unsigned char page_mode_column; // column the pointer wraps to in page addressing
+
+    unsigned char display_on;
+    unsigned char charge_pump;
+    unsigned char contrast;
+    unsigned char start_line;
+    unsigned char multiplex;
+    unsigned char display_offset;
+    unsigned char segment_remap;
+    unsigned char scan_reversed;
+    unsigned char inverse;
+    unsigned char entire_display_on;
+    struct ssd1306_scroll scroll;
+
+    // a command whose arguments are still coming in
+    unsigned char command[8];
+    size_t command_size;
+    size_t command_expected;
+
+    unsigned long long bytes;
+    unsigned long long transactions;
+    unsigned long long command_bytes;
+    unsigned long long data_bytes;
+    unsigned long long protocol_errors;
+};
+
+/***********************************************************/
+/****************** FUNCTION DEFINITIONS *******************/
+/***********************************************************/
+
+// State after reset, see the SSD1306 datasheet command table
+static inline void ssd1306_emulator_init(struct ssd1306_emulator *emulator)
+{
+    memset(emulator, 0, sizeof(*emulator));
+    emulator->memory_mode = (unsigned char)PAGE_ADDRESSING;
+    emulator->last_page = GRAM_PAGES - 1;
+    emulator->last_column = GRAM_WIDTH - 1;
+    emulator->contrast = 0x7F;
+    emulator->multiplex = GRAM_ROWS - 1;
+    emulator->charge_pump = 0x10;
+}
+
+static inline size_t ssd1306_argument_count(unsigned char command)
+{
+    switch ((char)command)
+    {
+    case SET_CONTRAST_COMMAND:
+    case PUMP_COMMAND:
+    case SET_MEMORY_MODE_COMMAND:
+    case SET_MUX_COMMAND:
+    case SET_DISPLAY_OFFSET_COMMAND:
+    case SET_CLOCK_DIV_COMMAND:
+    case SET_PRECHARGE_COMMAND:
+    case SET_COMM_PINS_COMMAND:
+    case SET_VCOMM_DETECT_COMMAND:
+        return 1;
+    case SET_COLUMN_START_ADDRESS:
+    case SET_PAGE_ADDRESS_COMMAND:
+    case SET_VERTICAL_SCROLL_AREA_COMMAND:
+        return 2;
+    case VERTICAL_RIGHT_SCROLL_COMMAND:
+    case VERTICAL_LEFT_SCROLL_COMMAND:
+        return 5;
+    case RIGHT_SCROLL_COMMAND:
+    case LEFT_SCROLL_COMMAND:
+        return 6;
+    default:
+        return 0;
+    }
+}
+
+static inline void ssd1306_execute(struct ssd1306_emulator *emulator)
+{
+    const unsigned char *command = emulator->command;
+    unsigned char opcode = command[0];
+
+    if (opcode >= (unsigned char)SET_START_LINE && opcode < (unsigned char)SET_START_LINE + GRAM_ROWS)
+    {
+        emulator->start_line = opcode & (GRAM_ROWS - 1);
+        return;
+    }
+
+    if (opcode >= (unsigned char)SET_PAGE_START_COMMAND && opcode < (unsigned char)SET_PAGE_START_COMMAND + GRAM_PAGES)
+    {
+        emulator->page = opcode & (GRAM_PAGES - 1);
+        return;
+    }
+
+    if (opcode < (unsigned char)SET_HIGHER_COLUMN_COMMAND)
+    {
+        emulator->page_mode_column = (emulator->page_mode_column & 0xF0) | (opcode & 0x0F);
+        emulator->column = emulator->page_mode_column;
+        return;
+    }
+
+    if (opcode < (unsigned char)SET_HIGHER_COLUMN_COMMAND + 0x08)
+    {
+        emulator->page_mode_column = (emulator->page_mode_column & 0x0F) | ((opcode & 0x07) << 4);
+        emulator->column = emulator->page_mode_column;
+        return;
+    }
+
+    switch ((char)opcode)
+    {
+    case SET_CONTRAST_COMMAND:
+        emulator->contrast = command[1];
+        break;
+    case PUMP_COMMAND:
+        emulator->charge_pump = command[1];
+        break;
+    case SET_MEMORY_MODE_COMMAND:
+        emulator->memory_mode = command[1] & 0x03;
+        break;
+    case SET_MUX_COMMAND:
+        emulator->multiplex = command[1] & (GRAM_ROWS - 1);
+        break;
+    case SET_DISPLAY_OFFSET_COMMAND:
+        emulator->display_offset = command[1] & (GRAM_ROWS - 1);
+        break;
+    case SET_COLUMN_START_ADDRESS:
+        emulator->first_column = emulator->column = command[1] & (GRAM_WIDTH - 1);
+        emulator->last_column = command[2] & (GRAM_WIDTH - 1);
+        break;
+    case SET_PAGE_ADDRESS_COMMAND:
+        emulator->first_page = emulator->page = command[1] & (GRAM_PAGES - 1);
+        emulator->last_page = command[2] & (GRAM_PAGES - 1);
+        break;
+    case SET_VERTICAL_SCROLL_AREA_COMMAND:
+        emulator->scroll.area_top = command[1];
+        emulator->scroll.area_rows = command[2];
+        break;
+    case RIGHT_SCROLL_COMMAND:
+    case LEFT_SCROLL_COMMAND:
+    case VERTICAL_RIGHT_SCROLL_COMMAND:
+    case VERTICAL_LEFT_SCROLL_COMMAND:
+        emulator->scroll.command = opcode;
+        emulator->scroll.first_page = command[2] & (GRAM_PAGES - 1);
+        emulator->scroll.interval = command[3] & 0x07;
+        emulator->scroll.last_page = command[4] & (GRAM_PAGES - 1);
+        emulator->scroll.vertical_offset = ssd1306_argument_count(opcode) == 5 ? command[5] : 0;
+        break;
+    case DEACTIVATE_SCROLL_COMMAND:
+        emulator->scroll.active = 0;
+        break;
+    case ACTIVATE_SCROLL_COMMAND:
+        emulator->scroll.active = 1;
+        break;
+    case SEG_NORMAL_COMMAND:
+    case SEG_REMAP_COMMAND:
+        emulator->segment_remap = opcode & 0x01;
+        break;
+    case SET_COMM_SCAN_NORMAL_COMMAND:
+    case SET_COMM_SCAN_COMMAND:
+        emulator->scan_reversed = (opcode & 0x08) != 0;
+        break;
+    case SET_DISPLAY_RESUME_COMMAND:
+    case SET_ENTIRE_DISPLAY_ON_COMMAND:
+        emulator->entire_display_on = opcode & 0x01;
+        break;
+    case SET_NORMAL_DISPLAY:
+    case SET_INVERSE_DISPLAY:
+        emulator->inverse = opcode & 0x01;
+        break;
+    case ENABLE_SCREEN_COMMAND:
+    case ENABLE_SCREEN_COMMAND | 1:
+        emulator->display_on = opcode & 0x01;
+        break;
+    case SET_CLOCK_DIV_COMMAND:
+    case SET_PRECHARGE_COMMAND:
+    case SET_COMM_PINS_COMMAND:
+    case SET_VCOMM_DETECT_COMMAND:
+    case NOP_COMMAND:
+        break;
+    default:
+        emulator->protocol_errors++;
+        break;
+    }
+}
+
+static inline void ssd1306_command_byte(struct ssd1306_emulator *emulator, unsigned char byte)
+{
+    emulator->command_bytes++;
+
+    if (emulator->command_size == 0)
+    {
+        emulator->command_expected = ssd1306_argument_count(byte) + 1;
+    }
+
+    emulator->command[emulator->command_size++] = byte;
+
+    if (emulator->command_size == emulator->command_expected)
+    {
+        ssd1306_execute(emulator);
+        emulator->command_size = 0;
+    }
+}
+
+// Writes at the pointer and advances it the way the active memory mode walks GRAM
+static inline void ssd1306_data_byte(struct ssd1306_emulator *emulator, unsigned char byte)
+{
+    emulator->data_bytes++;
+    emulator->gram[emulator->column + (GRAM_WIDTH * emulator->page)] = byte;
+
+    switch ((char)emulator->memory_mode)
+    {
+    case HORIZONTAL_ADDRESSING:
+        if (emulator->column++ >= emulator->last_column)
+        {
+            emulator->column = emulator->first_column;
+            emulator->page = emulator->page >= emulator->last_page ? emulator->first_page : emulator->page + 1;
+        }
+        break;
+    case VERTICAL_ADDRESSING:
+        if (emulator->page++ >= emulator->last_page)
+        {
+            emulator->page = emulator->first_page;
+            emulator->column = emulator->column >= emulator->last_column ? emulator->first_column
+                                                                         : emulator->column + 1;
+        }
+        break;
+    default:
+        if (emulator->column++ >= GRAM_WIDTH - 1)
+        {
+            emulator->column = emulator->page_mode_column;
+        }
+        break;
+    }
+}
+
+// Feeds one bus transaction, the slave address already stripped. Returns -1 when the transaction
+// ends in the middle of a command or without any payload.
+static inline int ssd1306_emulator_transaction(struct ssd1306_emulator *emulator, const unsigned char *buffer,
+                                               size_t size)
+{
+    unsigned char control;
+    size_t i = 0;
+
+    emulator->transactions++;
+    emulator->bytes += size;
+    emulator->command_size = 0;
+
+    while (i < size)
+    {
+        control = buffer[i++];
+
+        // Co set means a single byte follows before the next control byte
+        if (control & (unsigned char)CONTINUATION_BIT)
+        {
+            if (i >= size)
+            {
+                break;
+            }
+
+            if (control & (unsigned char)DATA)
+            {
+                ssd1306_data_byte(emulator, buffer[i++]);
+            }
+            else
+            {
+                ssd1306_command_byte(emulator, buffer[i++]);
+            }
+            continue;
+        }
+
+        for (; i < size; i++)
+        {
+            if (control & (unsigned char)DATA)
+            {
+                ssd1306_data_byte(emulator, buffer[i]);
+            }
+            else
+            {
+                ssd1306_command_byte(emulator, buffer[i]);
+            }
+        }
+    }
+
+    if (size < 2 || emulator->command_size != 0)
+    {
+        emulator->command_size = 0;
+        emulator->protocol_errors++;
+        return -1;
+    }
+
+    return 0;
+}
+
+// Pixel as the panel shows it on row, column of its visible area, start line and offset included
+static inline int ssd1306_emulator_pixel(const struct ssd1306_emulator *emulator, size_t row, size_t column)
+{
+    size_t line = (row + emulator->start_line + emulator->display_offset) & (GRAM_ROWS - 1);
+    int pixel = (emulator->gram[column + (GRAM_WIDTH * (line / 8))] >> (line % 8)) & 1;
+
+    if (!emulator->display_on)
+    {
+        return 0;
+    }
+
+    if (emulator->entire_display_on)
+    {
+        pixel = 1;
+    }
+
+    return pixel ^ emulator->inverse;
+}
+
+static inline size_t ssd1306_emulator_rows(const struct ssd1306_emulator *emulator)
+{
+    return (size_t)emulator->multiplex + 1;
+}
+
+#endif
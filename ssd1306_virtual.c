@@ -0,0 +1,285 @@
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/init.h>
+#include <linux/i2c.h>
+#include <linux/mutex.h>
+#include <linux/delay.h>
+#include <linux/ktime.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/fs.h>
+
+#include "ssd1306_emulator.h"
+
+MODULE_LICENSE("Dual BSD/GPL");
+
+// A virtual I2C adapter with an emulated SSD1306 behind it, so the lcd driver can be probed and
+// benchmarked without a panel:
+//
+//   make ssd1306_virtual.ko eindopdracht.ko
+//   insmod ssd1306_virtual.ko bus_speed=400000
+//   insmod eindopdracht.ko adapter_number=<number printed by ssd1306_virtual>
+
+/***********************************************************/
+/************************ DEFINES **************************/
+/***********************************************************/
+#define SSD1306_ADDRESS ((u16)0x3C)
+#define I2C_BITS_PER_BYTE ((u64)9)  // eight data bits plus ACK
+#define I2C_FRAMING_BITS ((u64)2)   // start and stop condition
+#define MAX_SPIN_DELAY_NS ((u64)10000)
+
+/***********************************************************/
+/****************** FUNCTION PROTOTYPES ********************/
+/***********************************************************/
+
+static int ssd1306_virtual_init(void);
+static void ssd1306_virtual_exit(void);
+
+static int virtual_xfer(struct i2c_adapter *, struct i2c_msg *, int);
+static u32 virtual_functionality(struct i2c_adapter *);
+static void bus_delay(size_t);
+
+static ssize_t gram_read(struct file *, char __user *, size_t, loff_t *);
+static int frame_show(struct seq_file *, void *);
+static int frame_open(struct inode *, struct file *);
+static int statistics_show(struct seq_file *, void *);
+static int statistics_open(struct inode *, struct file *);
+static ssize_t reset_write(struct file *, const char __user *, size_t, loff_t *);
+
+/***********************************************************/
+/******************** GLOBAL VARIABLES *********************/
+/***********************************************************/
+static unsigned int bus_speed = 0;
+module_param(bus_speed, uint, 0644);
+MODULE_PARM_DESC(bus_speed, "Emulated bus clock in Hz, transfers take as long as on a real bus (0 = no delay)");
+
+static int nr = -1;
+module_param(nr, int, 0444);
+MODULE_PARM_DESC(nr, "Adapter number to register, -1 picks a free one");
+
+static struct ssd1306_emulator emulator;
+static DEFINE_MUTEX(emulator_mutex);
+static u64 delayed_ns = 0;
+
+static struct dentry *debugfs_root = NULL;
+
+static const struct i2c_algorithm virtual_algorithm = {
+    .master_xfer = virtual_xfer,
+    .functionality = virtual_functionality,
+};
+
+static struct i2c_adapter virtual_adapter = {
+    .owner = THIS_MODULE,
+    .algo = &virtual_algorithm,
+    .name = "ssd1306-virtual",
+};
+
+static const struct file_operations gram_fops = {
+    .owner = THIS_MODULE,
+    .read = gram_read,
+};
+
+static const struct file_operations frame_fops = {
+    .owner = THIS_MODULE,
+    .open = frame_open,
+    .read = seq_read,
+    .llseek = seq_lseek,
+    .release = single_release,
+};
+
+static const struct file_operations statistics_fops = {
+    .owner = THIS_MODULE,
+    .open = statistics_open,
+    .read = seq_read,
+    .llseek = seq_lseek,
+    .release = single_release,
+};
+
+static const struct file_operations reset_fops = {
+    .owner = THIS_MODULE,
+    .write = reset_write,
+};
+
+/***********************************************************/
+/*********************** DRIVER INIT ***********************/
+/***********************************************************/
+
+module_init(ssd1306_virtual_init);
+module_exit(ssd1306_virtual_exit);
+
+/***********************************************************/
+/****************** FUNCTION DEFINITIONS *******************/
+/***********************************************************/
+
+#pragma region driver_init
+static int ssd1306_virtual_init(void)
+{
+    int result;
+
+    ssd1306_emulator_init(&emulator);
+
+    virtual_adapter.nr = nr;
+    result = i2c_add_numbered_adapter(&virtual_adapter);
+    if (result < 0)
+    {
+        printk(KERN_ERR "ssd1306_virtual could not register the adapter (%d)", result);
+        return result;
+    }
+
+    debugfs_root = debugfs_create_dir("ssd1306_virtual", NULL);
+    debugfs_create_file("gram", 00444, debugfs_root, NULL, &gram_fops);
+    debugfs_create_file("frame", 00444, debugfs_root, NULL, &frame_fops);
+    debugfs_create_file("statistics", 00444, debugfs_root, NULL, &statistics_fops);
+    debugfs_create_file("reset", 00200, debugfs_root, NULL, &reset_fops);
+
+    printk(KERN_INFO "ssd1306_virtual SSD1306 at 0x%02x on i2c-%d", SSD1306_ADDRESS, virtual_adapter.nr);
+    return 0;
+}
+
+static void ssd1306_virtual_exit(void)
+{
+    debugfs_remove_recursive(debugfs_root);
+    i2c_del_adapter(&virtual_adapter);
+}
+#pragma endregion
+
+#pragma region adapter
+// Every write message is one transaction on the emulated panel, the SSD1306 has no I2C reads
+static int virtual_xfer(struct i2c_adapter *adapter, struct i2c_msg *messages, int count)
+{
+    int i;
+
+    for (i = 0; i < count; i++)
+    {
+        if (messages[i].addr != SSD1306_ADDRESS)
+        {
+            return -ENXIO;
+        }
+
+        if (messages[i].flags & I2C_M_RD)
+        {
+            return -EOPNOTSUPP;
+        }
+
+        mutex_lock(&emulator_mutex);
+        ssd1306_emulator_transaction(&emulator, messages[i].buf, messages[i].len);
+        mutex_unlock(&emulator_mutex);
+
+        bus_delay(messages[i].len);
+    }
+
+    return count;
+}
+
+static u32 virtual_functionality(struct i2c_adapter *adapter)
+{
+    return I2C_FUNC_I2C;
+}
+
+// Holds the caller for as long as the address byte and size data bytes take at bus_speed
+static void bus_delay(size_t size)
+{
+    unsigned int speed = READ_ONCE(bus_speed);
+    u64 delay_ns;
+
+    if (speed == 0)
+    {
+        return;
+    }
+
+    delay_ns = div_u64(((size + 1) * I2C_BITS_PER_BYTE + I2C_FRAMING_BITS) * NSEC_PER_SEC, speed);
+
+    mutex_lock(&emulator_mutex);
+    delayed_ns += delay_ns;
+    mutex_unlock(&emulator_mutex);
+
+    if (delay_ns < MAX_SPIN_DELAY_NS)
+    {
+        ndelay(delay_ns);
+    }
+    else
+    {
+        fsleep(div_u64(delay_ns, NSEC_PER_USEC));
+    }
+}
+#pragma endregion
+
+#pragma region debugfs
+static ssize_t gram_read(struct file *file, char __user *buffer, size_t size, loff_t *offset)
+{
+    ssize_t result;
+
+    mutex_lock(&emulator_mutex);
+    result = simple_read_from_buffer(buffer, size, offset, emulator.gram, sizeof(emulator.gram));
+    mutex_unlock(&emulator_mutex);
+
+    return result;
+}
+
+// The visible rows as a plain PBM, the same format the host emulator writes
+static int frame_show(struct seq_file *file, void *data)
+{
+    size_t rows;
+    size_t row;
+    size_t column;
+
+    mutex_lock(&emulator_mutex);
+    rows = ssd1306_emulator_rows(&emulator);
+    seq_printf(file, "P1\n%d %zu\n", GRAM_WIDTH, rows);
+
+    for (row = 0; row < rows; row++)
+    {
+        for (column = 0; column < GRAM_WIDTH; column++)
+        {
+            seq_putc(file, ssd1306_emulator_pixel(&emulator, row, column) ? '1' : '0');
+        }
+
+        seq_putc(file, '\n');
+    }
+    mutex_unlock(&emulator_mutex);
+
+    return 0;
+}
+
+static int frame_open(struct inode *inode, struct file *file)
+{
+    return single_open(file, frame_show, NULL);
+}
+
+static int statistics_show(struct seq_file *file, void *data)
+{
+    mutex_lock(&emulator_mutex);
+    seq_printf(file, "transactions: %llu\n", emulator.transactions);
+    seq_printf(file, "bytes: %llu\n", emulator.bytes);
+    seq_printf(file, "command_bytes: %llu\n", emulator.command_bytes);
+    seq_printf(file, "data_bytes: %llu\n", emulator.data_bytes);
+    seq_printf(file, "protocol_errors: %llu\n", emulator.protocol_errors);
+    seq_printf(file, "bus_time_us: %llu\n", div_u64(delayed_ns, NSEC_PER_USEC));
+    seq_printf(file, "display: %s contrast %u start_line %u memory_mode %u scroll %s\n",
+               emulator.display_on ? "on" : "off", emulator.contrast, emulator.start_line, emulator.memory_mode,
+               emulator.scroll.active ? "active" : "off");
+    mutex_unlock(&emulator_mutex);
+
+    return 0;
+}
+
+static int statistics_open(struct inode *inode, struct file *file)
+{
+    return single_open(file, statistics_show, NULL);
+}
+
+// Clears the counters but keeps GRAM and the controller state, like a panel that stays powered
+static ssize_t reset_write(struct file *file, const char __user *buffer, size_t size, loff_t *offset)
+{
+    mutex_lock(&emulator_mutex);
+    emulator.transactions = 0;
+    emulator.bytes = 0;
+    emulator.command_bytes = 0;
+    emulator.data_bytes = 0;
+    emulator.protocol_errors = 0;
+    delayed_ns = 0;
+    mutex_unlock(&emulator_mutex);
+
+    return size;
+}
+#pragma endregion